@@ -2,22 +2,117 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <limits.h>
+#include <float.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <pthread.h>
 
 #define MAX_USERS 1000
 #define MAX_FAMILIES 100
 #define MAX_EXPENSES 1000
-#define CATEGORIES 5
+#define MAX_CATEGORIES 512
+#define DEFAULT_CATEGORIES 5        // built in, IDs 0-4
 #define DAYS_IN_MONTH 10
 #define MONTHS_IN_YEAR 12
+#define MAX_FAMILY_MEMBERS 4
+#define MEMBER_BITMAP_WORDS (MAX_USERS / 64 + 1)
+
+#define EXPENSE_STORE_FILE "expenses.dat"
+#define STORE_MAGIC 0x53505845      // "EXPS"
+#define STORE_VERSION 1
+#define STORE_PAGE_SIZE 4096
+#define CHECKPOINT_INTERVAL 50      // writes between automatic checkpoints
+#define RETAINED_VERSIONS 256       // newest expense versions kept for as-of reports
+#define RETAINED_DAYS 35            // before those, the last version of each day
+#define JOURNAL_FILE "journal.bin"
+#define JOURNAL_CAPACITY 4096       // change journal entries kept in memory for undo
+#define MAX_SHARDS 16
+#define REPLICATION_LOG "replication.log"
+#define REPLICA_POLL_US 5000        // replica checks the log this often
+#define LAG_SAMPLES 4096            // recent apply lags kept for percentiles
+#define RECURRING_FILE "recurring.txt"
+#define BUDGETS_FILE "budgets.txt"
+#define CATEGORIES_FILE "categories.txt"
+#define FAMILY_TOTAL -1             // budget slot of the family as a whole
+#define NAME_GRAM_MAX 256           // longest name prefix that is indexed
+#define NAME_RESULT_LIMIT 50
+#define REPORT_CACHE_SLOTS 1024     // power of two; bounds the report result cache
+#define ALERT_LOG "alerts.log"
+#define BUDGET_WARN_PCT 80          // first alert threshold, the second is 100%
+#define ANOMALY_THRESHOLD 3.0       // z-score at which an expense is flagged
+#define ANOMALY_MIN_HISTORY 5       // expenses needed in a category before scoring
+#define ANOMALY_MIN_SPREAD 0.01     // floor on the standard deviation, as a fraction of the mean
+#define ROLLING_DAYS 30             // longest rolling window, and its ring length
+#define ROLLING_WEEK 7
+
+// Names are interned: each distinct string is stored once in the name arena
+// and tree nodes only keep a 32-bit handle (byte offset) into it.
+typedef uint32_t NameRef;
 
-// Expense categories
-const char* categories[] = {"Rent", "Utility", "Grocery", "Stationary", "Leisure"};
+typedef struct {
+    char *data;         // append-only, NUL-separated strings
+    uint32_t used;
+    uint32_t capacity;
+    NameRef *slots;     // open addressing table of handles, 0 = empty
+    uint32_t slotCount;
+    uint32_t entries;
+} NameArena;
+
+// Running mean and variance of one user's spending in one category
+// (Welford), updated in O(1) per expense
+typedef struct {
+    long n;
+    double mean;
+    double m2;      // sum of squared deviations from the mean
+} SpendStats;
+
+// Spending over the last ROLLING_WEEK and ROLLING_DAYS days up to day.
+// Days are counted from the start of the year (see rollingDay) and each
+// day of the window sits at day % ROLLING_DAYS. All zero is an empty window.
+typedef struct {
+    int day;
+    float daily[ROLLING_DAYS];
+    float weekTotal;
+    float total;
+} RollingWindow;
+
+// Category dictionary entry. IDs are dense and never reused; a category
+// with a parent is a subcategory and rolls up into it.
+typedef struct {
+    NameRef name;
+    int parent;         // -1 for a top-level category
+    int depth;          // 0 for a top-level category
+} Category;
+
+// Sparse map from category ID to a fixed-size value, sorted by ID. A user
+// or family touches a handful of the categories, so per-category state
+// lives here rather than in arrays sized by the dictionary. An all-zero
+// map is empty; callers pass the size of the value type.
+typedef struct {
+    int count;
+    int capacity;
+    int *keys;
+    unsigned char *values;
+} CategoryMap;
 
 // Structures
 typedef struct Individual {
     int userID;
-    char userName[50];
+    NameRef userName;
     float income;
+    struct Expense *expenses;   // head of this user's expense list
+    int expenseCount;
+    CategoryMap spend;          // SpendStats by category
+    RollingWindow rolling;
     struct Individual *left;
     struct Individual *right;
     int height;
@@ -30,31 +125,206 @@ typedef struct Expense {
     float amount;
     int day;
     int month;
+    struct Expense *nextByUser;     // per-user list, see linkUserExpense
+    struct Expense *prevByUser;
+    float anomalyScore;             // z-score against the owner's history at insert
+    bool flagged;                   // on the flagged list, see trackSpending
+    struct Expense *nextFlagged;
+    struct Expense *prevFlagged;
     struct Expense *left;
     struct Expense *right;
     int height;
+    int count;      // nodes in this subtree
+    double sum;     // amounts in this subtree
 } Expense;
 
-typedef struct FamilyMember {
+// Node of a per-category amount index, ordered by (amount, expenseID)
+typedef struct AmountNode {
+    float amount;
+    int expenseID;
+    Expense *expense;
+    struct AmountNode *left;
+    struct AmountNode *right;
+    int height;
+    int count;      // nodes in this subtree
+} AmountNode;
+
+// Node of the date index, keyed by (month * 100 + day, expenseID)
+typedef struct DateNode {
+    int date;
+    int expenseID;
+    Expense *expense;
+    struct DateNode *left;
+    struct DateNode *right;
+    int height;
+} DateNode;
+
+// Node of a shard's own expense tree, keyed by expenseID
+typedef struct ShardNode {
+    Expense *expense;
+    struct ShardNode *left;
+    struct ShardNode *right;
+    int height;
+} ShardNode;
+
+// Node of the persistent (path-copying) expense tree. Once its version is
+// committed a node is never modified again: writers copy the path instead.
+typedef struct VersionNode {
+    int expenseID;
+    int userID;
+    int category;
+    float amount;
+    int day;
+    int month;
+    struct VersionNode *left;
+    struct VersionNode *right;
+    int height;
+    uint64_t born;      // version that created the node
+} VersionNode;
+
+// An immutable snapshot of the expense tree
+typedef struct {
+    uint64_t id;
+    time_t committedAt;
+    VersionNode *root;
+    int day;            // local calendar day of committedAt, see calendarDay
+    int pins;           // readers currently holding it
+} Version;
+
+// A node dropped from the tree while building version retiredAt. Versions
+// older than that may still reach it, so it is freed only once all of them
+// have been released (epoch-based reclamation with versions as epochs).
+typedef struct {
+    VersionNode *node;
+    uint64_t retiredAt;
+} RetiredNode;
+
+// "amount in category on day every month from startMonth to endMonth".
+// Occurrences up to postedThrough exist as real expenses; later ones are
+// generated on the fly by the reports that cover their dates.
+typedef struct {
+    int ruleID;
     int userID;
-    struct FamilyMember *next;
-} FamilyMember;
+    int category;
+    float amount;
+    int day;
+    int startMonth;
+    int endMonth;
+    int postedThrough;
+} RecurringRule;
+
+// Change journal entry kinds
+typedef enum {
+    JOURNAL_EXPENSE_ADD,
+    JOURNAL_EXPENSE_UPDATE,
+    JOURNAL_EXPENSE_DELETE,
+    JOURNAL_INDIVIDUAL_ADD,
+    JOURNAL_INDIVIDUAL_UPDATE,
+    JOURNAL_INDIVIDUAL_DELETE,
+    JOURNAL_FAMILY_ADD,
+    JOURNAL_FAMILY_UPDATE,
+    JOURNAL_FAMILY_DELETE,
+    JOURNAL_RULE_ADD,
+    JOURNAL_RULE_UPDATE,
+    JOURNAL_RULE_DELETE
+} JournalKind;
+
+// Fixed-size binary before-image of one record. An add stores the new
+// record instead, which is what undoing it needs. Entries written during
+// one menu action share an operation number and are undone together.
+typedef struct {
+    uint32_t op;
+    uint8_t kind;
+    uint8_t memberCount;
+    uint16_t reserved;
+    int32_t recordID;
+    int64_t loggedAt;
+    union {
+        struct {
+            int32_t userID;
+            int32_t category;
+            float amount;
+            int8_t day;
+            int8_t month;
+        } expense;
+        struct {
+            NameRef name;
+            float income;
+            int32_t familyID;   // -1 if not in a family
+        } individual;
+        struct {
+            NameRef name;
+            int32_t members[MAX_FAMILY_MEMBERS];
+        } family;
+        struct {
+            int32_t userID;
+            int32_t category;
+            float amount;
+            int8_t day;
+            int8_t startMonth;
+            int8_t endMonth;
+            int8_t postedThrough;
+        } rule;
+    } before;
+} JournalEntry;
+
+// Running sums behind a family's month-end forecast for one month and
+// category: spend, and spend weighted by day of month. Together with the
+// month's latest expense day a least squares line through the daily totals
+// needs nothing more.
+typedef struct {
+    float spend;
+    float daySpend;
+} TrendSums;
+
+// alertLevel is the highest threshold already reported: 0 none, 1 warning,
+// 2 exceeded
+typedef struct {
+    float limit;
+    uint8_t alertLevel;
+} Budget;
 
 typedef struct Family {
     int familyID;
-    char familyName[50];
-    FamilyMember *members;
+    NameRef familyName;
+    int members[MAX_FAMILY_MEMBERS];
+    int memberCount;
+    uint64_t memberBits[MEMBER_BITMAP_WORDS];   // bit per userID, for isMember
     float totalIncome;
     float totalExpense;
+    CategoryMap categoryExpense;    // float by category, subcategories included
+    CategoryMap budgets;            // Budget by category or FAMILY_TOTAL
+    CategoryMap trend;              // TrendSums by (month - 1) * MAX_CATEGORIES + category
+    uint8_t trendLastDay[MONTHS_IN_YEAR];   // does not move back on removal
+    uint32_t generation;            // changes whenever a family report could, see touchFamily
+    RollingWindow rolling;
     struct Family *left;
     struct Family *right;
     int height;
 } Family;
 
+// One family's share of an expense batch. Changes are summed per key while
+// the batch runs and applied to the family once at the end.
+typedef struct FamilyBatch {
+    Family *family;
+    CategoryMap spend;      // float by category
+    CategoryMap trend;      // TrendSums, keyed like Family.trend
+    CategoryMap days;       // float by month * 100 + day, for the rolling window
+    int trendLastDay[MONTHS_IN_YEAR];
+    struct FamilyBatch *next;
+} FamilyBatch;
+
+// The families a batch touches, reached through their members
+typedef struct {
+    Family **familyOf;      // by userID
+    FamilyBatch **batchOf;  // by userID, once the member's family is touched
+    FamilyBatch *touched;
+} BatchFamilies;
+
 typedef struct ExpenseAccumulator {
     int targetUserID;
     float total;
-    float categoriesTotal[CATEGORIES];
+    CategoryMap categoriesTotal;    // float by category
 } ExpenseAccumulator;
 
 // Date range filter structure
@@ -70,22 +340,145 @@ typedef struct {
     int startID;
     int endID;
     bool hasResults;
+    float total;
 } IDRangeFilter;
 
 // Daily expense tracker structure
 typedef struct {
-    int familyID;
+    Family *family;
     float dailyExpenses[MONTHS_IN_YEAR][DAYS_IN_MONTH];
 } DailyExpenseTracker;
 
 
 typedef struct {
     int userID;
-    char name[50];
+    NameRef name;
     float amount;
 } Contribution;
 
 
+// On-disk expense store (expenses.dat), read through mmap:
+//   page 0                  StoreHeader
+//   pages 1..indexPages     first expenseID of every data page
+//   remaining pages         ExpenseRecords sorted by expenseID
+typedef struct {
+    int expenseID;
+    int userID;
+    int category;
+    float amount;
+    int day;
+    int month;
+} ExpenseRecord;
+
+#define RECORDS_PER_PAGE ((int)(STORE_PAGE_SIZE / sizeof(ExpenseRecord)))
+#define INDEX_ENTRIES_PER_PAGE ((int)(STORE_PAGE_SIZE / sizeof(int)))
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t recordCount;
+    uint32_t dataPages;
+    uint32_t indexPages;
+} StoreHeader;
+
+// While cold, the expense tree is empty and reads are served from the
+// mapping; loadExpenseTrees builds the tree on the first write.
+typedef struct {
+    void *base;
+    size_t length;
+    const StoreHeader *header;
+    const int *pageFirstID;
+    const ExpenseRecord *pages;
+    bool cold;
+} ExpenseStore;
+
+// Read-optimized copy of the expense and individual trees' key order, see
+// freezeTrees. Keys are in Eytzinger (breadth-first) order, 1-based, with
+// the node of each key at the same position; expenseOrder is the in-order
+// node sequence for scans.
+typedef struct {
+    bool active;
+    int expenseCount;
+    int *expenseKeys;
+    Expense **expenseNodes;
+    Expense **expenseOrder;
+    int userCount;
+    int *userKeys;
+    Individual **userNodes;
+} FrozenTrees;
+
+// One record of a batch passed to applyExpenseBatch
+typedef enum { BATCH_INSERT, BATCH_UPDATE, BATCH_DELETE } BatchOp;
+
+typedef struct {
+    BatchOp op;
+    int expenseID;
+    int userID;         // inserts only
+    int category;
+    float amount;
+    int day;
+    int month;
+    int seq;            // position in the input, later records win
+} ExpenseMutation;
+
+typedef struct {
+    int inserted;
+    int updated;
+    int deleted;
+    int rejected;
+} BatchResult;
+
+// Ad-hoc expense query. Every field is a predicate; the defaults set by
+// initExpenseQuery match everything, so callers only fill in what they need.
+typedef struct {
+    int userID;                 // -1 = any
+    Family *family;             // NULL = any
+    int category;               // -1 = any
+    float minAmount, maxAmount;
+    int startDate, endDate;     // month * 100 + day, inclusive
+    int startID, endID;         // inclusive
+} ExpenseQuery;
+
+// Access paths the planner can choose from
+typedef enum { PATH_FULL_SCAN, PATH_ID_RANGE, PATH_USER_LIST, PATH_FAMILY_LISTS } QueryPath;
+
+typedef enum {
+    SHARD_SCAN,             // rows matching a query, in ID order
+    SHARD_TOP_AMOUNTS,      // k largest amounts
+    SHARD_CATEGORY_TOTALS   // per-category totals of matching rows
+} ShardTaskKind;
+
+typedef struct {
+    ShardTaskKind kind;
+    const ExpenseQuery *query;
+    int k;
+} ShardTask;
+
+typedef struct {
+    ShardNode *root;        // this shard's expenses, keyed by ID
+    int count;
+    pthread_t worker;       // started on the shard's first task, then kept
+    bool started;
+    const ShardTask *task;  // pending task; the worker clears it when done
+    Expense **out;          // scan results, or a min-heap of the top k
+    int outCount;
+    int outCapacity;
+    CategoryMap categoryTotals;     // double by category
+} ExpenseShard;
+
+#define EXPENSE_STACK_DEPTH 64
+
+// Iterates the rows of one query; see openQuery/nextQueryResult
+typedef struct {
+    ExpenseQuery query;
+    QueryPath path;
+    int memberIndex;                        // family path: member being walked
+    Expense *listPos;                       // user/family paths: next list node
+    Expense *stack[EXPENSE_STACK_DEPTH];    // tree paths: pending in-order nodes
+    int depth;
+    int scanned;                            // rows looked at, for the plan report
+} QueryCursor;
+
 typedef struct {
     int category;
     Contribution *contributions;
@@ -97,6 +490,400 @@ typedef struct {
 Individual *individualsRoot = NULL;
 Family *familiesRoot = NULL;
 Expense *expensesRoot = NULL;
+AmountNode *amountIndex[MAX_CATEGORIES] = {NULL};
+DateNode *dateIndex = NULL;
+Category categoryTable[MAX_CATEGORIES];
+int categoryCount = 0;
+ExpenseStore expenseStore = {0};
+FrozenTrees frozen = {0};
+
+// Expense versions, oldest first. The tree for version buildingVersion is
+// assembled in pendingRoot and published by commitVersion.
+Version *versions = NULL;
+int versionCount = 0;
+int versionCapacity = 0;
+uint64_t buildingVersion = 1;
+VersionNode *pendingRoot = NULL;
+RetiredNode *retired = NULL;
+int retiredHead = 0;
+int retiredCount = 0;
+int retiredCapacity = 0;
+int retiredAfterSweep = 0;      // retiredCount after the last full sweep
+
+// Change journal: a ring of the newest entries, older ones spill to
+// JOURNAL_FILE. Only operations still entirely in the ring can be undone.
+JournalEntry journal[JOURNAL_CAPACITY];
+int journalHead = 0;
+int journalCount = 0;
+uint32_t journalOp = 0;         // operation the next entries belong to
+uint32_t journalSpilledOp = 0;  // newest operation with entries on disk
+uint32_t journalBarrierOp = 0;  // newest operation the journal cannot reverse
+bool journalPaused = false;     // set while undoing
+unsigned long mutationCount = 0;    // changes applied, undos included
+FILE *journalFile = NULL;
+
+// Log shipping. The primary appends every mutation to REPLICATION_LOG as a
+// redo record; a process started with --replica tails it and applies the
+// records to its own trees. The replica never writes data files.
+FILE *replicationLog = NULL;
+unsigned long long replicationSeq = 0;
+
+// Family shards, see placeShardExpense. Writes keep them current; changing
+// the shard count or warming the expense store marks them stale and the
+// next query rebuilds them.
+bool shardsStale = true;
+ExpenseShard shards[MAX_SHARDS];
+int shardCount = 4;
+int userShard[MAX_USERS + 1];
+pthread_mutex_t shardLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t shardWake = PTHREAD_COND_INITIALIZER;   // a task was handed out
+pthread_cond_t shardIdle = PTHREAD_COND_INITIALIZER;   // the last one finished
+int shardsBusy = 0;
+
+// Source of family generations. Drawn from one counter so a family created
+// under a deleted one's ID never matches its cached reports.
+uint32_t familyGenerationClock = 0;
+
+// Recurring expense rules, in creation order
+RecurringRule *rules = NULL;
+int ruleCount = 0;
+int ruleCapacity = 0;
+int nextRuleID = 1;
+
+// Budget alerts are appended here as they happen; opened on the first one
+FILE *alertLog = NULL;
+bool replicaMode = false;       // replicas stay quiet and write nothing
+
+// Expenses whose anomaly score reached ANOMALY_THRESHOLD, newest first
+Expense *flaggedExpenses = NULL;
+int flaggedCount = 0;
+
+// Rolling windows end at the latest expense date seen so far; categories
+// include their subcategories
+int rollingToday = 0;
+RollingWindow categoryRolling[MAX_CATEGORIES];
+
+// Background checkpoint state, see startCheckpoint
+pid_t checkpointPid = 0;
+double checkpointStartMs = 0.0;
+double checkpointStallMs = 0.0;
+int writesSinceCheckpoint = 0;
+NameArena names = {0};
+
+// FNV-1a, good enough for short names
+uint32_t hashName(const char *name) {
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+const char* nameOf(NameRef ref) {
+    return names.data + ref;
+}
+
+void growNameSlots() {
+    uint32_t newCount = names.slotCount ? names.slotCount * 2 : 256;
+    NameRef *newSlots = (NameRef*)calloc(newCount, sizeof(NameRef));
+
+    for (uint32_t i = 0; i < names.slotCount; i++) {
+        NameRef ref = names.slots[i];
+        if (ref == 0) continue;
+        uint32_t j = hashName(nameOf(ref)) & (newCount - 1);
+        while (newSlots[j] != 0)
+            j = (j + 1) & (newCount - 1);
+        newSlots[j] = ref;
+    }
+    free(names.slots);
+    names.slots = newSlots;
+    names.slotCount = newCount;
+}
+
+// Returns the handle of an existing copy of name, or appends it to the arena.
+// Handle 0 is the empty string.
+NameRef internName(const char *name) {
+    if (names.data == NULL) {
+        names.capacity = 4096;
+        names.data = (char*)malloc(names.capacity);
+        names.data[0] = '\0';
+        names.used = 1;
+    }
+    if (*name == '\0') return 0;
+
+    // keep load factor under 1/2
+    if ((names.entries + 1) * 2 > names.slotCount)
+        growNameSlots();
+
+    uint32_t i = hashName(name) & (names.slotCount - 1);
+    while (names.slots[i] != 0) {
+        if (strcmp(nameOf(names.slots[i]), name) == 0)
+            return names.slots[i];
+        i = (i + 1) & (names.slotCount - 1);
+    }
+
+    uint32_t len = (uint32_t)strlen(name) + 1;
+    while (names.used + len > names.capacity) {
+        names.capacity *= 2;
+        names.data = (char*)realloc(names.data, names.capacity);
+    }
+    NameRef ref = names.used;
+    memcpy(names.data + ref, name, len);
+    names.used += len;
+    names.slots[i] = ref;
+    names.entries++;
+    return ref;
+}
+
+bool isValidCategory(int category) {
+    return category >= 0 && category < categoryCount;
+}
+
+const char* categoryName(int category) {
+    return isValidCategory(category) ? nameOf(categoryTable[category].name) : "?";
+}
+
+// True if category is ancestor or one of its subcategories
+bool categoryWithin(int category, int ancestor) {
+    while (isValidCategory(category)) {
+        if (category == ancestor)
+            return true;
+        category = categoryTable[category].parent;
+    }
+    return false;
+}
+
+// Returns the new ID, or -1 if the dictionary is full, the parent does not
+// exist or already has a subcategory of that name
+int addCategory(const char *name, int parent) {
+    if (categoryCount == MAX_CATEGORIES || *name == '\0' ||
+        (parent != -1 && !isValidCategory(parent)))
+        return -1;
+    NameRef ref = internName(name);
+    for (int c = 0; c < categoryCount; c++) {
+        if (categoryTable[c].name == ref && categoryTable[c].parent == parent)
+            return -1;
+    }
+    Category *cat = &categoryTable[categoryCount];
+    cat->name = ref;
+    cat->parent = parent;
+    cat->depth = parent < 0 ? 0 : categoryTable[parent].depth + 1;
+    return categoryCount++;
+}
+
+void initCategories() {
+    const char *builtIn[DEFAULT_CATEGORIES] = {"Rent", "Utility", "Grocery", "Stationary", "Leisure"};
+    categoryCount = 0;
+    for (int c = 0; c < DEFAULT_CATEGORIES; c++)
+        addCategory(builtIn[c], -1);
+}
+
+// Spells the choices out while the dictionary is small
+void printCategoryPrompt(const char *extra) {
+    printf("Enter Category (");
+    if (categoryCount <= 10) {
+        for (int c = 0; c < categoryCount; c++)
+            printf("%s%d-%s", c ? ", " : "", c, categoryName(c));
+    } else {
+        printf("0-%d, see Categories", categoryCount - 1);
+    }
+    if (extra != NULL)
+        printf(", %s", extra);
+    printf("): ");
+}
+
+// Index of key in the map, or where it would be inserted
+int categoryMapSlot(const CategoryMap *map, int key) {
+    int lo = 0, hi = map->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (map->keys[mid] < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+void* categoryMapAt(const CategoryMap *map, int i, size_t size) {
+    return map->values + (size_t)i * size;
+}
+
+void* categoryMapFind(const CategoryMap *map, int key, size_t size) {
+    int i = categoryMapSlot(map, key);
+    if (i < map->count && map->keys[i] == key)
+        return categoryMapAt(map, i, size);
+    return NULL;
+}
+
+// Returns key's value, adding a zeroed one if it is missing
+void* categoryMapGet(CategoryMap *map, int key, size_t size) {
+    int i = categoryMapSlot(map, key);
+    if (i < map->count && map->keys[i] == key)
+        return categoryMapAt(map, i, size);
+
+    if (map->count == map->capacity) {
+        map->capacity = map->capacity ? map->capacity * 2 : 4;
+        map->keys = (int*)realloc(map->keys, sizeof(int) * map->capacity);
+        map->values = (unsigned char*)realloc(map->values, size * map->capacity);
+    }
+    memmove(&map->keys[i + 1], &map->keys[i], sizeof(int) * (map->count - i));
+    memmove(map->values + (size_t)(i + 1) * size, map->values + (size_t)i * size,
+            size * (map->count - i));
+    map->keys[i] = key;
+    map->count++;
+    void *value = categoryMapAt(map, i, size);
+    memset(value, 0, size);
+    return value;
+}
+
+void categoryMapRemove(CategoryMap *map, int key, size_t size) {
+    int i = categoryMapSlot(map, key);
+    if (i == map->count || map->keys[i] != key)
+        return;
+    memmove(&map->keys[i], &map->keys[i + 1], sizeof(int) * (map->count - i - 1));
+    memmove(map->values + (size_t)i * size, map->values + (size_t)(i + 1) * size,
+            size * (map->count - i - 1));
+    map->count--;
+}
+
+void categoryMapFree(CategoryMap *map) {
+    free(map->keys);
+    free(map->values);
+    memset(map, 0, sizeof(CategoryMap));
+}
+
+float categoryAmount(const CategoryMap *map, int category) {
+    float *amount = (float*)categoryMapFind(map, category, sizeof(float));
+    return amount ? *amount : 0;
+}
+
+void addCategoryAmount(CategoryMap *map, int category, float delta) {
+    *(float*)categoryMapGet(map, category, sizeof(float)) += delta;
+}
+
+// Adds delta to category and to each category above it
+void rollUpCategoryAmount(CategoryMap *map, int category, float delta) {
+    for (int c = category; isValidCategory(c); c = categoryTable[c].parent)
+        addCategoryAmount(map, c, delta);
+}
+
+// Name search. An inverted index maps each lowercase trigram to the users
+// and families whose name contains it; names are padded with two start
+// marks so that prefixes of one or two letters have grams too. Renames and
+// deletes leave the old postings behind: every hit is checked against the
+// current name, and the next search rebuilds the index once stale postings
+// outnumber live ones.
+#define NAME_START '\1'
+
+typedef enum { NAME_USER, NAME_FAMILY } NameKind;
+
+typedef struct {
+    uint32_t gram;      // three lowercase bytes; 0 marks an empty slot
+    int count;
+    int capacity;
+    int *postings;      // id * 2 + NameKind, in insertion order
+} GramList;
+
+typedef struct {
+    GramList *slots;    // open addressing on gram
+    uint32_t slotCount;
+    uint32_t used;
+    long postings;
+    long stale;
+} NameIndex;
+
+NameIndex nameIndex = {0};
+
+// Distinct grams of name, after two start marks when anchored. grams needs
+// room for NAME_GRAM_MAX entries.
+int nameGrams(const char *name, bool anchored, uint32_t *grams) {
+    unsigned char text[NAME_GRAM_MAX + 2];
+    int len = 0, count = 0;
+    if (anchored) {
+        text[len++] = NAME_START;
+        text[len++] = NAME_START;
+    }
+    for (const char *p = name; *p != '\0' && len < NAME_GRAM_MAX + 2; p++)
+        text[len++] = (unsigned char)tolower((unsigned char)*p);
+
+    for (int i = 0; i + 2 < len; i++) {
+        uint32_t gram = (uint32_t)text[i] << 16 | (uint32_t)text[i + 1] << 8 | text[i + 2];
+        bool seen = false;
+        for (int j = 0; j < count && !seen; j++)
+            seen = (grams[j] == gram);
+        if (!seen)
+            grams[count++] = gram;
+    }
+    return count;
+}
+
+uint32_t gramSlot(uint32_t gram, uint32_t slotCount) {
+    return (gram * 2654435761u) & (slotCount - 1);
+}
+
+void growGramSlots() {
+    uint32_t newCount = nameIndex.slotCount ? nameIndex.slotCount * 2 : 1024;
+    GramList *newSlots = (GramList*)calloc(newCount, sizeof(GramList));
+    for (uint32_t i = 0; i < nameIndex.slotCount; i++) {
+        if (nameIndex.slots[i].gram == 0) continue;
+        uint32_t j = gramSlot(nameIndex.slots[i].gram, newCount);
+        while (newSlots[j].gram != 0)
+            j = (j + 1) & (newCount - 1);
+        newSlots[j] = nameIndex.slots[i];
+    }
+    free(nameIndex.slots);
+    nameIndex.slots = newSlots;
+    nameIndex.slotCount = newCount;
+}
+
+GramList* findGram(uint32_t gram, bool create) {
+    if (create && (nameIndex.used + 1) * 2 > nameIndex.slotCount)
+        growGramSlots();
+    if (nameIndex.slotCount == 0)
+        return NULL;
+    uint32_t i = gramSlot(gram, nameIndex.slotCount);
+    while (nameIndex.slots[i].gram != 0) {
+        if (nameIndex.slots[i].gram == gram)
+            return &nameIndex.slots[i];
+        i = (i + 1) & (nameIndex.slotCount - 1);
+    }
+    if (!create)
+        return NULL;
+    nameIndex.slots[i].gram = gram;
+    nameIndex.used++;
+    return &nameIndex.slots[i];
+}
+
+void indexName(NameKind kind, int id, NameRef name) {
+    uint32_t grams[NAME_GRAM_MAX];
+    int n = nameGrams(nameOf(name), true, grams);
+    int posting = id * 2 + kind;
+    for (int i = 0; i < n; i++) {
+        GramList *list = findGram(grams[i], true);
+        if (list->count > 0 && list->postings[list->count - 1] == posting)
+            continue;
+        if (list->count == list->capacity) {
+            list->capacity = list->capacity ? list->capacity * 2 : 4;
+            list->postings = (int*)realloc(list->postings, sizeof(int) * list->capacity);
+        }
+        list->postings[list->count++] = posting;
+        nameIndex.postings++;
+    }
+}
+
+// The postings of name are left in place and only counted as stale
+void dropIndexedName(NameRef name) {
+    uint32_t grams[NAME_GRAM_MAX];
+    nameIndex.stale += nameGrams(nameOf(name), true, grams);
+}
+
+double nowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
 
 // Function to check if date is valid
 bool isValidDate(int day, int month) {
@@ -127,6 +914,25 @@ int heightExpense(Expense *node) {
     return node->height;
 }
 
+int countExpense(Expense *node) {
+    if (node == NULL)
+        return 0;
+    return node->count;
+}
+
+double sumExpense(Expense *node) {
+    if (node == NULL)
+        return 0.0;
+    return node->sum;
+}
+
+// Recomputes height and the order-statistic fields from the children
+void updateExpenseNode(Expense *node) {
+    node->height = max(heightExpense(node->left), heightExpense(node->right)) + 1;
+    node->count = countExpense(node->left) + countExpense(node->right) + 1;
+    node->sum = sumExpense(node->left) + sumExpense(node->right) + node->amount;
+}
+
 Individual *rightRotateIndividual(Individual *y) {
     Individual *x = y->left;
     Individual *T2 = x->right;
@@ -160,8 +966,8 @@ Expense *rightRotateExpense(Expense *y) {
     x->right = y;
     y->left = T2;
 
-    y->height = max(heightExpense(y->left), heightExpense(y->right)) + 1;
-    x->height = max(heightExpense(x->left), heightExpense(x->right)) + 1;
+    updateExpenseNode(y);
+    updateExpenseNode(x);
 
     return x;
 }
@@ -199,8 +1005,8 @@ Expense *leftRotateExpense(Expense *x) {
     y->left = x;
     x->right = T2;
 
-    x->height = max(heightExpense(x->left), heightExpense(x->right)) + 1;
-    y->height = max(heightExpense(y->left), heightExpense(y->right)) + 1;
+    updateExpenseNode(x);
+    updateExpenseNode(y);
 
     return y;
 }
@@ -223,13 +1029,46 @@ int getBalanceExpense(Expense *node) {
     return heightExpense(node->left) - heightExpense(node->right);
 }
 
+// Position of key in an Eytzinger array of n keys, 0 if absent. The descent
+// has no data-dependent branch: each step picks a child by a comparison,
+// and the trailing right turns are undone at the end. The prefetch pulls in
+// the keys four levels down, which share one cache line.
+int eytzingerFind(const int *keys, int n, int key) {
+    int k = 1;
+    while (k <= n) {
+        __builtin_prefetch(keys + 16 * k);
+        k = 2 * k + (keys[k] < key);
+    }
+    k >>= __builtin_ffs(~k);
+    return (k != 0 && keys[k] == key) ? k : 0;
+}
+
+// Back to the live trees. They are never changed while frozen, so this only
+// drops the arrays; every insert or delete calls it first.
+void thawTrees() {
+    if (!frozen.active)
+        return;
+    free(frozen.expenseKeys);
+    free(frozen.expenseNodes);
+    free(frozen.expenseOrder);
+    free(frozen.userKeys);
+    free(frozen.userNodes);
+    memset(&frozen, 0, sizeof(frozen));
+}
+
 // Individual AVL operations
 Individual* insertIndividual(Individual* node, int userID, char* userName, float income) {
+    thawTrees();
     if (node == NULL) {
         Individual* newNode = (Individual*)malloc(sizeof(Individual));
         newNode->userID = userID;
-        strcpy(newNode->userName, userName);
+        newNode->userName = internName(userName);
+        indexName(NAME_USER, userID, newNode->userName);
         newNode->income = income;
+        newNode->expenses = NULL;
+        newNode->expenseCount = 0;
+        memset(&newNode->spend, 0, sizeof(newNode->spend));
+        memset(&newNode->rolling, 0, sizeof(newNode->rolling));
         newNode->left = NULL;
         newNode->right = NULL;
         newNode->height = 1;
@@ -271,6 +1110,10 @@ Individual* insertIndividual(Individual* node, int userID, char* userName, float
 }
 
 Individual* searchIndividual(Individual* root, int userID) {
+    if (frozen.active && root == individualsRoot) {
+        int k = eytzingerFind(frozen.userKeys, frozen.userCount, userID);
+        return k ? frozen.userNodes[k] : NULL;
+    }
     if (root == NULL || root->userID == userID)
         return root;
 
@@ -281,14 +1124,27 @@ Individual* searchIndividual(Individual* root, int userID) {
 }
 
 // Family AVL operations
+void touchFamily(Family *family) {
+    if (family != NULL)
+        family->generation = ++familyGenerationClock;
+}
+
 Family* insertFamily(Family* node, int familyID, char* familyName) {
     if (node == NULL) {
         Family* newNode = (Family*)malloc(sizeof(Family));
         newNode->familyID = familyID;
-        strcpy(newNode->familyName, familyName);
-        newNode->members = NULL;
+        newNode->familyName = internName(familyName);
+        indexName(NAME_FAMILY, familyID, newNode->familyName);
+        newNode->memberCount = 0;
+        memset(newNode->memberBits, 0, sizeof(newNode->memberBits));
         newNode->totalIncome = 0.0;
         newNode->totalExpense = 0.0;
+        memset(&newNode->categoryExpense, 0, sizeof(newNode->categoryExpense));
+        memset(&newNode->budgets, 0, sizeof(newNode->budgets));
+        memset(&newNode->trend, 0, sizeof(newNode->trend));
+        memset(newNode->trendLastDay, 0, sizeof(newNode->trendLastDay));
+        memset(&newNode->rolling, 0, sizeof(newNode->rolling));
+        touchFamily(newNode);
         newNode->left = NULL;
         newNode->right = NULL;
         newNode->height = 1;
@@ -339,118 +1195,383 @@ Family* searchFamily(Family* root, int familyID) {
     return searchFamily(root->left, familyID);
 }
 
-// Helper function to find family by user ID
-void searchFamilies(Family* node, int userID, Family** result) {
-    if (node == NULL || *result != NULL) return;
-    
-    FamilyMember *m = node->members;
-    while (m != NULL) {
-        if (m->userID == userID) {
-            *result = node;
-            return;
-        }
-        m = m->next;
-    }
-    
-    searchFamilies(node->left, userID, result);
-    searchFamilies(node->right, userID, result);
+void setIndividualName(Individual *ind, NameRef name) {
+    if (name == ind->userName)
+        return;
+    dropIndexedName(ind->userName);
+    ind->userName = name;
+    indexName(NAME_USER, ind->userID, name);
 }
 
-// Expense AVL operations
-Expense* insertExpense(Expense* node, int expenseID, int userID, int category, float amount, int day, int month) {
-    if (node == NULL) {
-        Expense* newNode = (Expense*)malloc(sizeof(Expense));
-        newNode->expenseID = expenseID;
-        newNode->userID = userID;
-        newNode->category = category;
-        newNode->amount = amount;
-        newNode->day = day;
-        newNode->month = month;
-        newNode->left = NULL;
-        newNode->right = NULL;
-        newNode->height = 1;
-        return newNode;
-    }
+void setFamilyName(Family *family, NameRef name) {
+    if (name == family->familyName)
+        return;
+    dropIndexedName(family->familyName);
+    family->familyName = name;
+    indexName(NAME_FAMILY, family->familyID, name);
+}
 
-    if (expenseID < node->expenseID)
-        node->left = insertExpense(node->left, expenseID, userID, category, amount, day, month);
-    else if (expenseID > node->expenseID)
-        node->right = insertExpense(node->right, expenseID, userID, category, amount, day, month);
-    else
-        return node; // Duplicate expenseIDs not allowed
+// Family shards: expenses are partitioned by the owner's family (familyID %
+// shardCount; users without a family by userID). Each shard owns an AVL of
+// its expenses keyed by ID, kept in step by the expense writers in
+// O(log N); a membership change moves only that user's expenses.
 
-    node->height = 1 + max(heightExpense(node->left), heightExpense(node->right));
+int heightShard(ShardNode *node) {
+    if (node == NULL)
+        return 0;
+    return node->height;
+}
 
-    int balance = getBalanceExpense(node);
+ShardNode *rightRotateShard(ShardNode *y) {
+    ShardNode *x = y->left;
+    ShardNode *T2 = x->right;
 
-    // Left Left Case
-    if (balance > 1 && expenseID < node->left->expenseID)
-        return rightRotateExpense(node);
+    x->right = y;
+    y->left = T2;
 
-    // Right Right Case
-    if (balance < -1 && expenseID > node->right->expenseID)
-        return leftRotateExpense(node);
+    y->height = max(heightShard(y->left), heightShard(y->right)) + 1;
+    x->height = max(heightShard(x->left), heightShard(x->right)) + 1;
 
-    // Left Right Case
-    if (balance > 1 && expenseID > node->left->expenseID) {
-        node->left = leftRotateExpense(node->left);
-        return rightRotateExpense(node);
-    }
+    return x;
+}
 
-    // Right Left Case
-    if (balance < -1 && expenseID < node->right->expenseID) {
-        node->right = rightRotateExpense(node->right);
-        return leftRotateExpense(node);
-    }
+ShardNode *leftRotateShard(ShardNode *x) {
+    ShardNode *y = x->right;
+    ShardNode *T2 = y->left;
 
-    return node;
-}
+    y->left = x;
+    x->right = T2;
 
-Expense* searchExpense(Expense* root, int expenseID) {
-    if (root == NULL || root->expenseID == expenseID)
-        return root;
+    x->height = max(heightShard(x->left), heightShard(x->right)) + 1;
+    y->height = max(heightShard(y->left), heightShard(y->right)) + 1;
 
-    if (root->expenseID < expenseID)
-        return searchExpense(root->right, expenseID);
+    return y;
+}
 
-    return searchExpense(root->left, expenseID);
+int getBalanceShard(ShardNode *node) {
+    if (node == NULL)
+        return 0;
+    return heightShard(node->left) - heightShard(node->right);
 }
 
-// Family member operations
-void addFamilyMember(Family *family, int userID) {
-    FamilyMember *newMember = (FamilyMember*)malloc(sizeof(FamilyMember));
-    newMember->userID = userID;
-    newMember->next = family->members;
-    family->members = newMember;
-    
-    // Update family income
-    Individual *ind = searchIndividual(individualsRoot, userID);
-    if (ind != NULL) {
-        family->totalIncome += ind->income;
+ShardNode* rebalanceShard(ShardNode* root) {
+    root->height = max(heightShard(root->left), heightShard(root->right)) + 1;
+    int balance = getBalanceShard(root);
+
+    if(balance > 1 && getBalanceShard(root->left) >= 0)
+        return rightRotateShard(root);
+    if(balance > 1 && getBalanceShard(root->left) < 0) {
+        root->left = leftRotateShard(root->left);
+        return rightRotateShard(root);
     }
+    if(balance < -1 && getBalanceShard(root->right) <= 0)
+        return leftRotateShard(root);
+    if(balance < -1 && getBalanceShard(root->right) > 0) {
+        root->right = rightRotateShard(root->right);
+        return leftRotateShard(root);
+    }
+
+    return root;
 }
 
-bool isMember(Family *family, int userID) {
-    FamilyMember *current = family->members;
-    while (current != NULL) {
-        if (current->userID == userID)
-            return true;
-        current = current->next;
+ShardNode* insertShardNode(ShardNode* node, Expense* exp) {
+    if (node == NULL) {
+        ShardNode* newNode = (ShardNode*)malloc(sizeof(ShardNode));
+        newNode->expense = exp;
+        newNode->left = NULL;
+        newNode->right = NULL;
+        newNode->height = 1;
+        return newNode;
     }
-    return false;
+
+    if (exp->expenseID < node->expense->expenseID)
+        node->left = insertShardNode(node->left, exp);
+    else if (exp->expenseID > node->expense->expenseID)
+        node->right = insertShardNode(node->right, exp);
+    else
+        return node;
+
+    return rebalanceShard(node);
+}
+
+ShardNode* detachMinShard(ShardNode* node, ShardNode** min) {
+    if (node->left == NULL) {
+        *min = node;
+        return node->right;
+    }
+    node->left = detachMinShard(node->left, min);
+    return rebalanceShard(node);
+}
+
+ShardNode* deleteShardNode(ShardNode* root, int expenseID) {
+    if(root == NULL) return root;
+
+    if(expenseID < root->expense->expenseID)
+        root->left = deleteShardNode(root->left, expenseID);
+    else if(expenseID > root->expense->expenseID)
+        root->right = deleteShardNode(root->right, expenseID);
+    else {
+        ShardNode *doomed = root;
+        if((root->left == NULL) || (root->right == NULL)) {
+            root = root->left ? root->left : root->right;
+        } else {
+            ShardNode* successor;
+            ShardNode* right = detachMinShard(root->right, &successor);
+            successor->left = root->left;
+            successor->right = right;
+            root = successor;
+        }
+        free(doomed);
+    }
+
+    if(root == NULL) return root;
+
+    return rebalanceShard(root);
+}
+
+void freeShardTree(ShardNode *node) {
+    if (node == NULL) return;
+    freeShardTree(node->left);
+    freeShardTree(node->right);
+    free(node);
+}
+
+int shardOfUser(int userID) {
+    return (userID >= 0 && userID <= MAX_USERS) ? userShard[userID] : 0;
+}
+
+// Called by every writer that links an expense into the trees, and before
+// one is freed. No-ops while the shards are stale.
+void placeShardExpense(Expense *exp) {
+    if (shardsStale) return;
+    ExpenseShard *shard = &shards[shardOfUser(exp->userID)];
+    shard->root = insertShardNode(shard->root, exp);
+    shard->count++;
+}
+
+void dropShardExpense(Expense *exp) {
+    if (shardsStale) return;
+    ExpenseShard *shard = &shards[shardOfUser(exp->userID)];
+    shard->root = deleteShardNode(shard->root, exp->expenseID);
+    shard->count--;
+}
+
+// Points a user at the shard of family (NULL = none) and moves their
+// expenses there, in O(k log N) for k expenses
+void routeUser(int userID, Family *family) {
+    if (shardsStale || userID < 0 || userID > MAX_USERS)
+        return;
+    int target = (family != NULL ? family->familyID : userID) % shardCount;
+    if (target == userShard[userID])
+        return;
+    Individual *ind = searchIndividual(individualsRoot, userID);
+    for (Expense *exp = ind != NULL ? ind->expenses : NULL; exp != NULL; exp = exp->nextByUser)
+        dropShardExpense(exp);
+    userShard[userID] = target;
+    for (Expense *exp = ind != NULL ? ind->expenses : NULL; exp != NULL; exp = exp->nextByUser)
+        placeShardExpense(exp);
+}
+
+// Family member operations
+bool isMember(Family *family, int userID) {
+    if (userID < 0 || userID > MAX_USERS)
+        return false;
+    return (family->memberBits[userID / 64] >> (userID % 64)) & 1;
 }
 
 int countMembers(Family *family) {
-    int count = 0;
-    FamilyMember *current = family->members;
-    while (current != NULL) {
-        count++;
-        current = current->next;
+    return family->memberCount;
+}
+
+// Returns false if the family is full or the user is already a member
+bool addFamilyMember(Family *family, int userID) {
+    if (family->memberCount >= MAX_FAMILY_MEMBERS || isMember(family, userID) ||
+        userID < 0 || userID > MAX_USERS)
+        return false;
+
+    family->members[family->memberCount++] = userID;
+    routeUser(userID, family);
+    touchFamily(family);
+    family->memberBits[userID / 64] |= (uint64_t)1 << (userID % 64);
+    
+    // Update family income
+    Individual *ind = searchIndividual(individualsRoot, userID);
+    if (ind != NULL) {
+        family->totalIncome += ind->income;
     }
-    return count;
+    return true;
+}
+
+// Order of the remaining members is not preserved
+bool removeFamilyMember(Family *family, int userID) {
+    if (!isMember(family, userID))
+        return false;
+
+    for (int i = 0; i < family->memberCount; i++) {
+        if (family->members[i] == userID) {
+            family->members[i] = family->members[--family->memberCount];
+            break;
+        }
+    }
+    family->memberBits[userID / 64] &= ~((uint64_t)1 << (userID % 64));
+    routeUser(userID, NULL);
+    touchFamily(family);
+    return true;
+}
+
+// Helper function to find family by user ID
+void searchFamilies(Family* node, int userID, Family** result) {
+    if (node == NULL || *result != NULL) return;
+    
+    if (isMember(node, userID)) {
+        *result = node;
+        return;
+    }
+    
+    searchFamilies(node->left, userID, result);
+    searchFamilies(node->right, userID, result);
+}
+
+// Expense AVL operations
+Expense* insertExpense(Expense* node, int expenseID, int userID, int category, float amount, int day, int month) {
+    thawTrees();
+    if (node == NULL) {
+        Expense* newNode = (Expense*)malloc(sizeof(Expense));
+        newNode->expenseID = expenseID;
+        newNode->userID = userID;
+        newNode->category = category;
+        newNode->amount = amount;
+        newNode->day = day;
+        newNode->month = month;
+        newNode->nextByUser = NULL;
+        newNode->prevByUser = NULL;
+        newNode->anomalyScore = 0;
+        newNode->flagged = false;
+        newNode->left = NULL;
+        newNode->right = NULL;
+        newNode->height = 1;
+        newNode->count = 1;
+        newNode->sum = amount;
+        return newNode;
+    }
+
+    if (expenseID < node->expenseID)
+        node->left = insertExpense(node->left, expenseID, userID, category, amount, day, month);
+    else if (expenseID > node->expenseID)
+        node->right = insertExpense(node->right, expenseID, userID, category, amount, day, month);
+    else
+        return node; // Duplicate expenseIDs not allowed
+
+    updateExpenseNode(node);
+
+    int balance = getBalanceExpense(node);
+
+    // Left Left Case
+    if (balance > 1 && expenseID < node->left->expenseID)
+        return rightRotateExpense(node);
+
+    // Right Right Case
+    if (balance < -1 && expenseID > node->right->expenseID)
+        return leftRotateExpense(node);
+
+    // Left Right Case
+    if (balance > 1 && expenseID > node->left->expenseID) {
+        node->left = leftRotateExpense(node->left);
+        return rightRotateExpense(node);
+    }
+
+    // Right Left Case
+    if (balance < -1 && expenseID < node->right->expenseID) {
+        node->right = rightRotateExpense(node->right);
+        return leftRotateExpense(node);
+    }
+
+    return node;
+}
+
+// Expense store reads. Only the index pages and the one data page that
+// can hold the ID are touched, so a lookup faults in at most a few pages.
+
+void recordToExpense(const ExpenseRecord *rec, Expense *exp) {
+    memset(exp, 0, sizeof(Expense));
+    exp->expenseID = rec->expenseID;
+    exp->userID = rec->userID;
+    exp->category = rec->category;
+    exp->amount = rec->amount;
+    exp->day = rec->day;
+    exp->month = rec->month;
+    exp->height = 1;
+    exp->count = 1;
+    exp->sum = rec->amount;
+}
+
+const ExpenseRecord* storeRecord(uint32_t i) {
+    return &expenseStore.pages[i];
+}
+
+// Returns a read-only copy that stays valid until the next call
+Expense* searchExpenseStore(int expenseID) {
+    static Expense found;
+    const StoreHeader *h = expenseStore.header;
+    if (h->recordCount == 0)
+        return NULL;
+
+    // Last data page whose first ID is <= expenseID
+    int lo = 0, hi = (int)h->dataPages - 1, page = -1;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (expenseStore.pageFirstID[mid] <= expenseID) {
+            page = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    if (page < 0)
+        return NULL;
+
+    uint32_t first = (uint32_t)page * RECORDS_PER_PAGE;
+    uint32_t last = first + RECORDS_PER_PAGE;
+    if (last > h->recordCount)
+        last = h->recordCount;
+
+    lo = (int)first;
+    hi = (int)last - 1;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        const ExpenseRecord *rec = storeRecord(mid);
+        if (rec->expenseID == expenseID) {
+            recordToExpense(rec, &found);
+            return &found;
+        }
+        if (rec->expenseID < expenseID)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return NULL;
+}
+
+// Callers pass the tree root; while the store is cold the tree is empty
+// and lookups go to the mapped file instead.
+Expense* searchExpense(Expense* root, int expenseID) {
+    if (root == NULL && expenseStore.cold)
+        return searchExpenseStore(expenseID);
+    if (frozen.active && root == expensesRoot) {
+        int k = eytzingerFind(frozen.expenseKeys, frozen.expenseCount, expenseID);
+        return k ? frozen.expenseNodes[k] : NULL;
+    }
+    if (root == NULL || root->expenseID == expenseID)
+        return root;
+
+    if (root->expenseID < expenseID)
+        return searchExpense(root->right, expenseID);
+
+    return searchExpense(root->left, expenseID);
 }
 
 Individual* deleteIndividual(Individual* root, int userID) {
+    thawTrees();
     if (root == NULL) return root;
 
     if (userID < root->userID)
@@ -458,6 +1579,7 @@ Individual* deleteIndividual(Individual* root, int userID) {
     else if(userID > root->userID)
         root->right = deleteIndividual(root->right, userID);
     else {
+        categoryMapFree(&root->spend);
         if((root->left == NULL) || (root->right == NULL)) {
             Individual *temp = root->left ? root->left : root->right;
             if(temp == NULL) {
@@ -471,8 +1593,14 @@ Individual* deleteIndividual(Individual* root, int userID) {
             while(temp->left != NULL)
                 temp = temp->left;
             root->userID = temp->userID;
-            strcpy(root->userName, temp->userName);
+            root->userName = temp->userName;
             root->income = temp->income;
+            root->expenses = temp->expenses;
+            root->expenseCount = temp->expenseCount;
+            // The successor's map moves here; its node is freed below
+            root->spend = temp->spend;
+            root->rolling = temp->rolling;
+            memset(&temp->spend, 0, sizeof(temp->spend));
             root->right = deleteIndividual(root->right, temp->userID);
         }
     }
@@ -501,15 +1629,21 @@ Individual* deleteIndividual(Individual* root, int userID) {
     return root;
 }
 
+void freeFamilyMaps(Family *family) {
+    categoryMapFree(&family->categoryExpense);
+    categoryMapFree(&family->budgets);
+    categoryMapFree(&family->trend);
+}
+
 Family* deleteFamily(Family* root, int familyID) {
     if(root == NULL) return root;
 
-
     if(familyID < root->familyID)
         root->left = deleteFamily(root->left, familyID);
     else if(familyID > root->familyID)
         root->right = deleteFamily(root->right, familyID);
     else {
+        freeFamilyMaps(root);
         if((root->left == NULL) || (root->right == NULL)) {
             Family *temp = root->left ? root->left : root->right;
             if(temp == NULL) {
@@ -525,7 +1659,22 @@ Family* deleteFamily(Family* root, int familyID) {
             while(temp->left != NULL)
                 temp = temp->left;
             root->familyID = temp->familyID;
-            strcpy(root->familyName, temp->familyName);
+            root->familyName = temp->familyName;
+            memcpy(root->members, temp->members, sizeof(root->members));
+            root->memberCount = temp->memberCount;
+            memcpy(root->memberBits, temp->memberBits, sizeof(root->memberBits));
+            root->totalIncome = temp->totalIncome;
+            root->totalExpense = temp->totalExpense;
+            // The successor's maps move here; its node is freed below
+            root->categoryExpense = temp->categoryExpense;
+            root->budgets = temp->budgets;
+            root->trend = temp->trend;
+            memcpy(root->trendLastDay, temp->trendLastDay, sizeof(root->trendLastDay));
+            root->rolling = temp->rolling;
+            root->generation = temp->generation;
+            memset(&temp->categoryExpense, 0, sizeof(temp->categoryExpense));
+            memset(&temp->budgets, 0, sizeof(temp->budgets));
+            memset(&temp->trend, 0, sizeof(temp->trend));
             root->right = deleteFamily(root->right, temp->familyID);
         }
     }
@@ -556,39 +1705,8 @@ Family* deleteFamily(Family* root, int familyID) {
     return root;
 }
 
-Expense* deleteExpense(Expense* root, int expenseID) {
-    if(root == NULL) return root;
-
-    if(expenseID < root->expenseID)
-        root->left = deleteExpense(root->left, expenseID);
-    else if(expenseID > root->expenseID)
-        root->right = deleteExpense(root->right, expenseID);
-    else {
-        if((root->left == NULL) || (root->right == NULL)) {
-            Expense *temp = root->left ? root->left : root->right;
-            if(temp == NULL) {
-                temp = root;
-                root = NULL;
-            } else 
-                *root = *temp;
-            free(temp);
-        } else {
-            Expense* temp = root->right;
-            while(temp->left != NULL)
-                temp = temp->left;
-            root->expenseID = temp->expenseID;
-            root->userID = temp->userID;
-            root->category = temp->category;
-            root->amount = temp->amount;
-            root->day = temp->day;
-            root->month = temp->month;
-            root->right = deleteExpense(root->right, temp->expenseID);
-        }
-    }
-
-    if(root == NULL) return root;
-
-    root->height = 1 + max(heightExpense(root->left), heightExpense(root->right));
+Expense* rebalanceExpense(Expense* root) {
+    updateExpenseNode(root);
     int balance = getBalanceExpense(root);
 
     // Rebalancing
@@ -608,951 +1726,5698 @@ Expense* deleteExpense(Expense* root, int expenseID) {
     return root;
 }
 
-// Find family by user ID
-Family* findFamilyByUserID(int userID) {
-    Family* result = NULL;
-    searchFamilies(familiesRoot, userID, &result);
-    return result;
+// Unlinks the leftmost node of the subtree and hands it back through min
+Expense* detachMinExpense(Expense* node, Expense** min) {
+    if (node->left == NULL) {
+        *min = node;
+        return node->right;
+    }
+    node->left = detachMinExpense(node->left, min);
+    return rebalanceExpense(node);
 }
 
-// Required functions
-void Add_User() {
-    int userID;
-    char userName[50];
-    float income;
-    
-    while (1) {
-        printf("Enter User ID(1-1000): ");
-        scanf("%d", &userID);
-        
-        if (userID < 0 || userID > 1000) {
-            printf("Error: Invalid User ID. Please enter a valid userid(1-1000).\n");
-            continue;
-        }
-        
-        if (searchIndividual(individualsRoot, userID) != NULL) {
-            printf("Error: User ID %d already exists. Please enter a different ID.\n", userID);
-            continue;
+// Nodes are relinked rather than copied, so an Expense* stays valid until
+// that exact expense is deleted (the per-user lists rely on this).
+Expense* deleteExpense(Expense* root, int expenseID) {
+    thawTrees();
+    if(root == NULL) return root;
+
+    if(expenseID < root->expenseID)
+        root->left = deleteExpense(root->left, expenseID);
+    else if(expenseID > root->expenseID)
+        root->right = deleteExpense(root->right, expenseID);
+    else {
+        Expense *doomed = root;
+        if((root->left == NULL) || (root->right == NULL)) {
+            root = root->left ? root->left : root->right;
+        } else {
+            Expense* successor;
+            Expense* right = detachMinExpense(root->right, &successor);
+            successor->left = root->left;
+            successor->right = right;
+            root = successor;
         }
-        
-        // Check if user is already in any family
-        Family* existingFamily = NULL;
-        searchFamilies(familiesRoot, userID, &existingFamily);
-        if (existingFamily != NULL) {
-            printf("Error: User ID %d is already a member of family %s. Please enter a different ID.\n", 
-                  userID, existingFamily->familyName);
-            continue;
+        free(doomed);
+    }
+
+    if(root == NULL) return root;
+
+    return rebalanceExpense(root);
+}
+
+// Call after changing an expense's amount in place so the subtree sums on
+// its root path are recomputed
+void refreshExpensePath(Expense* root, int expenseID) {
+    if (root == NULL) return;
+    if (expenseID < root->expenseID)
+        refreshExpensePath(root->left, expenseID);
+    else if (expenseID > root->expenseID)
+        refreshExpensePath(root->right, expenseID);
+    updateExpenseNode(root);
+}
+
+// Count and amount total of all expenses with ID < bound, in O(log N)
+void expensesBelow(Expense* root, long bound, int* count, double* sum) {
+    *count = 0;
+    *sum = 0.0;
+    while (root != NULL) {
+        if (root->expenseID < bound) {
+            *count += countExpense(root->left) + 1;
+            *sum += sumExpense(root->left) + root->amount;
+            root = root->right;
+        } else {
+            root = root->left;
         }
-        
-        break;
     }
-    
-    printf("Enter User Name: ");
-    scanf("%s", userName);
-    printf("Enter Income: ");
-    scanf("%f", &income);
-    
-    individualsRoot = insertIndividual(individualsRoot, userID, userName, income);
-    printf("User added successfully!\n");
 }
 
-void Add_Expense() {
-    int expenseID, userID, category, day, month;
-    float amount;
-    
-    while (1) {
-        printf("Enter Expense ID (1 - 1000): ");
-        scanf("%d", &expenseID);
-        
-        if (expenseID < 0 || expenseID > 1000) {
-            printf("Error: Invalid Expense ID.\n");
-            continue;
+// Count and amount total of expenses with startID <= ID <= endID
+void expenseRangeTotals(Expense* root, int startID, int endID, int* count, double* sum) {
+    int lowCount, highCount;
+    double lowSum, highSum;
+    expensesBelow(root, startID, &lowCount, &lowSum);
+    expensesBelow(root, (long)endID + 1, &highCount, &highSum);
+    *count = highCount - lowCount;
+    *sum = highSum - lowSum;
+}
+
+// 1-based position of expenseID in ID order, or 0 if it does not exist
+int expenseRank(Expense* root, int expenseID) {
+    int rank = 0;
+    while (root != NULL) {
+        if (expenseID < root->expenseID) {
+            root = root->left;
+        } else if (expenseID > root->expenseID) {
+            rank += countExpense(root->left) + 1;
+            root = root->right;
+        } else {
+            return rank + countExpense(root->left) + 1;
         }
-        
-        if (searchExpense(expensesRoot, expenseID) != NULL) {
-            printf("Error: Expense ID %d already exists.\n", expenseID);
-            continue;
+    }
+    return 0;
+}
+
+// The k-th expense in ID order (1-based), or NULL if out of range
+Expense* selectExpense(Expense* root, int k) {
+    while (root != NULL) {
+        int leftCount = countExpense(root->left);
+        if (k <= leftCount) {
+            root = root->left;
+        } else if (k == leftCount + 1) {
+            return root;
+        } else {
+            k -= leftCount + 1;
+            root = root->right;
         }
-        
-        break;
     }
-    
-    while (1) {
-        printf("Enter User ID: ");
-        scanf("%d", &userID);
+    return NULL;
+}
+
+// Amount index: one AVL per category keyed by (amount, expenseID) with
+// subtree counts, so thresholds, percentiles and top/bottom N are O(log n).
+
+int heightAmount(AmountNode *node) {
+    if (node == NULL)
+        return 0;
+    return node->height;
+}
+
+int countAmount(AmountNode *node) {
+    if (node == NULL)
+        return 0;
+    return node->count;
+}
+
+void updateAmountNode(AmountNode *node) {
+    node->height = max(heightAmount(node->left), heightAmount(node->right)) + 1;
+    node->count = countAmount(node->left) + countAmount(node->right) + 1;
+}
+
+// Orders (amount, expenseID) against a node's key
+int compareAmountKey(float amount, int expenseID, AmountNode *node) {
+    if (amount != node->amount)
+        return (amount < node->amount) ? -1 : 1;
+    if (expenseID != node->expenseID)
+        return (expenseID < node->expenseID) ? -1 : 1;
+    return 0;
+}
+
+AmountNode *rightRotateAmount(AmountNode *y) {
+    AmountNode *x = y->left;
+    AmountNode *T2 = x->right;
+
+    x->right = y;
+    y->left = T2;
+
+    updateAmountNode(y);
+    updateAmountNode(x);
+
+    return x;
+}
+
+AmountNode *leftRotateAmount(AmountNode *x) {
+    AmountNode *y = x->right;
+    AmountNode *T2 = y->left;
+
+    y->left = x;
+    x->right = T2;
+
+    updateAmountNode(x);
+    updateAmountNode(y);
+
+    return y;
+}
+
+int getBalanceAmount(AmountNode *node) {
+    if (node == NULL)
+        return 0;
+    return heightAmount(node->left) - heightAmount(node->right);
+}
+
+AmountNode* rebalanceAmount(AmountNode* root) {
+    updateAmountNode(root);
+    int balance = getBalanceAmount(root);
+
+    if(balance > 1 && getBalanceAmount(root->left) >= 0)
+        return rightRotateAmount(root);
+    if(balance > 1 && getBalanceAmount(root->left) < 0) {
+        root->left = leftRotateAmount(root->left);
+        return rightRotateAmount(root);
+    }
+    if(balance < -1 && getBalanceAmount(root->right) <= 0)
+        return leftRotateAmount(root);
+    if(balance < -1 && getBalanceAmount(root->right) > 0) {
+        root->right = rightRotateAmount(root->right);
+        return leftRotateAmount(root);
+    }
+
+    return root;
+}
+
+AmountNode* insertAmount(AmountNode* node, Expense* exp) {
+    if (node == NULL) {
+        AmountNode* newNode = (AmountNode*)malloc(sizeof(AmountNode));
+        newNode->amount = exp->amount;
+        newNode->expenseID = exp->expenseID;
+        newNode->expense = exp;
+        newNode->left = NULL;
+        newNode->right = NULL;
+        newNode->height = 1;
+        newNode->count = 1;
+        return newNode;
+    }
+
+    int cmp = compareAmountKey(exp->amount, exp->expenseID, node);
+    if (cmp < 0)
+        node->left = insertAmount(node->left, exp);
+    else if (cmp > 0)
+        node->right = insertAmount(node->right, exp);
+    else
+        return node;
+
+    return rebalanceAmount(node);
+}
+
+AmountNode* detachMinAmount(AmountNode* node, AmountNode** min) {
+    if (node->left == NULL) {
+        *min = node;
+        return node->right;
+    }
+    node->left = detachMinAmount(node->left, min);
+    return rebalanceAmount(node);
+}
+
+AmountNode* deleteAmount(AmountNode* root, float amount, int expenseID) {
+    if (root == NULL) return root;
+
+    int cmp = compareAmountKey(amount, expenseID, root);
+    if (cmp < 0)
+        root->left = deleteAmount(root->left, amount, expenseID);
+    else if (cmp > 0)
+        root->right = deleteAmount(root->right, amount, expenseID);
+    else {
+        AmountNode *doomed = root;
+        if (root->left == NULL || root->right == NULL) {
+            root = root->left ? root->left : root->right;
+        } else {
+            AmountNode* successor;
+            AmountNode* right = detachMinAmount(root->right, &successor);
+            successor->left = root->left;
+            successor->right = right;
+            root = successor;
+        }
+        free(doomed);
+    }
+
+    if (root == NULL) return root;
+
+    return rebalanceAmount(root);
+}
+
+// Date index: one AVL over all expenses ordered by date, then ID, so date
+// windows can be paged without scanning the expenses outside them.
+
+int heightDate(DateNode *node) {
+    if (node == NULL)
+        return 0;
+    return node->height;
+}
+
+// Orders (date, expenseID) against a node's key
+int compareDateKey(int date, int expenseID, DateNode *node) {
+    if (date != node->date)
+        return (date < node->date) ? -1 : 1;
+    if (expenseID != node->expenseID)
+        return (expenseID < node->expenseID) ? -1 : 1;
+    return 0;
+}
+
+DateNode *rightRotateDate(DateNode *y) {
+    DateNode *x = y->left;
+    DateNode *T2 = x->right;
+
+    x->right = y;
+    y->left = T2;
+
+    y->height = max(heightDate(y->left), heightDate(y->right)) + 1;
+    x->height = max(heightDate(x->left), heightDate(x->right)) + 1;
+
+    return x;
+}
+
+DateNode *leftRotateDate(DateNode *x) {
+    DateNode *y = x->right;
+    DateNode *T2 = y->left;
+
+    y->left = x;
+    x->right = T2;
+
+    x->height = max(heightDate(x->left), heightDate(x->right)) + 1;
+    y->height = max(heightDate(y->left), heightDate(y->right)) + 1;
+
+    return y;
+}
+
+int getBalanceDate(DateNode *node) {
+    if (node == NULL)
+        return 0;
+    return heightDate(node->left) - heightDate(node->right);
+}
+
+DateNode* rebalanceDate(DateNode* root) {
+    root->height = max(heightDate(root->left), heightDate(root->right)) + 1;
+    int balance = getBalanceDate(root);
+
+    if(balance > 1 && getBalanceDate(root->left) >= 0)
+        return rightRotateDate(root);
+    if(balance > 1 && getBalanceDate(root->left) < 0) {
+        root->left = leftRotateDate(root->left);
+        return rightRotateDate(root);
+    }
+    if(balance < -1 && getBalanceDate(root->right) <= 0)
+        return leftRotateDate(root);
+    if(balance < -1 && getBalanceDate(root->right) > 0) {
+        root->right = rightRotateDate(root->right);
+        return leftRotateDate(root);
+    }
+
+    return root;
+}
+
+DateNode* insertDate(DateNode* node, Expense* exp) {
+    int date = exp->month * 100 + exp->day;
+    if (node == NULL) {
+        DateNode* newNode = (DateNode*)malloc(sizeof(DateNode));
+        newNode->date = date;
+        newNode->expenseID = exp->expenseID;
+        newNode->expense = exp;
+        newNode->left = NULL;
+        newNode->right = NULL;
+        newNode->height = 1;
+        return newNode;
+    }
+
+    int cmp = compareDateKey(date, exp->expenseID, node);
+    if (cmp < 0)
+        node->left = insertDate(node->left, exp);
+    else if (cmp > 0)
+        node->right = insertDate(node->right, exp);
+    else
+        return node;
+
+    return rebalanceDate(node);
+}
+
+DateNode* detachMinDate(DateNode* node, DateNode** min) {
+    if (node->left == NULL) {
+        *min = node;
+        return node->right;
+    }
+    node->left = detachMinDate(node->left, min);
+    return rebalanceDate(node);
+}
+
+DateNode* deleteDate(DateNode* root, int date, int expenseID) {
+    if (root == NULL) return root;
+
+    int cmp = compareDateKey(date, expenseID, root);
+    if (cmp < 0)
+        root->left = deleteDate(root->left, date, expenseID);
+    else if (cmp > 0)
+        root->right = deleteDate(root->right, date, expenseID);
+    else {
+        DateNode *doomed = root;
+        if (root->left == NULL || root->right == NULL) {
+            root = root->left ? root->left : root->right;
+        } else {
+            DateNode* successor;
+            DateNode* right = detachMinDate(root->right, &successor);
+            successor->left = root->left;
+            successor->right = right;
+            root = successor;
+        }
+        free(doomed);
+    }
+
+    if (root == NULL) return root;
+
+    return rebalanceDate(root);
+}
+
+// Keeps the amount and date indexes. Must be called with the expense's
+// current category, amount and date, i.e. unindex before changing any of
+// them and index again afterwards.
+void indexExpense(Expense *exp) {
+    amountIndex[exp->category] = insertAmount(amountIndex[exp->category], exp);
+    dateIndex = insertDate(dateIndex, exp);
+}
+
+void unindexExpense(Expense *exp) {
+    amountIndex[exp->category] = deleteAmount(amountIndex[exp->category], exp->amount, exp->expenseID);
+    dateIndex = deleteDate(dateIndex, exp->month * 100 + exp->day, exp->expenseID);
+}
+
+// Number of indexed expenses with amount <= threshold
+int countAmountAtMost(AmountNode* root, float threshold) {
+    int count = 0;
+    while (root != NULL) {
+        if (root->amount <= threshold) {
+            count += countAmount(root->left) + 1;
+            root = root->right;
+        } else {
+            root = root->left;
+        }
+    }
+    return count;
+}
+
+// The k-th smallest amount (1-based), or NULL if out of range
+AmountNode* selectAmount(AmountNode* root, int k) {
+    while (root != NULL) {
+        int leftCount = countAmount(root->left);
+        if (k <= leftCount) {
+            root = root->left;
+        } else if (k == leftCount + 1) {
+            return root;
+        } else {
+            k -= leftCount + 1;
+            root = root->right;
+        }
+    }
+    return NULL;
+}
+
+// Nearest-rank percentile, p in (0, 100]
+AmountNode* amountPercentile(AmountNode* root, float p) {
+    int n = countAmount(root);
+    if (n == 0) return NULL;
+    int k = (int)((p / 100.0) * n + 0.999999);
+    if (k < 1) k = 1;
+    if (k > n) k = n;
+    return selectAmount(root, k);
+}
+
+// Persistent expense tree. Every mutation path-copies the nodes it touches
+// into pendingRoot and commitVersion publishes the result as a new immutable
+// version. Readers pin a version and read it without locks while writers
+// keep building new ones; replaced nodes go to the retired list and are
+// freed once no retained or pinned version can reach them.
+
+int heightVersion(VersionNode *node) {
+    if (node == NULL)
+        return 0;
+    return node->height;
+}
+
+void retireVersionNode(VersionNode *node) {
+    // Never published, nobody else can see it
+    if (node->born == buildingVersion) {
+        free(node);
+        return;
+    }
+    if (retiredHead + retiredCount == retiredCapacity) {
+        if (retiredHead > 0) {
+            memmove(retired, retired + retiredHead, sizeof(RetiredNode) * retiredCount);
+            retiredHead = 0;
+        } else {
+            retiredCapacity = retiredCapacity ? retiredCapacity * 2 : 1024;
+            retired = (RetiredNode*)realloc(retired, sizeof(RetiredNode) * retiredCapacity);
+        }
+    }
+    retired[retiredHead + retiredCount].node = node;
+    retired[retiredHead + retiredCount].retiredAt = buildingVersion;
+    retiredCount++;
+}
+
+// Returns a node of the version being built that may be modified: the node
+// itself if it was created for this version, otherwise a copy of it
+VersionNode* writableVersionNode(VersionNode *node) {
+    if (node->born == buildingVersion)
+        return node;
+    VersionNode *copy = (VersionNode*)malloc(sizeof(VersionNode));
+    *copy = *node;
+    copy->born = buildingVersion;
+    retireVersionNode(node);
+    return copy;
+}
+
+VersionNode* newVersionNode(Expense *exp) {
+    VersionNode *node = (VersionNode*)malloc(sizeof(VersionNode));
+    node->expenseID = exp->expenseID;
+    node->userID = exp->userID;
+    node->category = exp->category;
+    node->amount = exp->amount;
+    node->day = exp->day;
+    node->month = exp->month;
+    node->left = NULL;
+    node->right = NULL;
+    node->height = 1;
+    node->born = buildingVersion;
+    return node;
+}
+
+// y must already be writable
+VersionNode *rightRotateVersion(VersionNode *y) {
+    VersionNode *x = writableVersionNode(y->left);
+    y->left = x->right;
+    x->right = y;
+
+    y->height = max(heightVersion(y->left), heightVersion(y->right)) + 1;
+    x->height = max(heightVersion(x->left), heightVersion(x->right)) + 1;
+
+    return x;
+}
+
+// x must already be writable
+VersionNode *leftRotateVersion(VersionNode *x) {
+    VersionNode *y = writableVersionNode(x->right);
+    x->right = y->left;
+    y->left = x;
+
+    x->height = max(heightVersion(x->left), heightVersion(x->right)) + 1;
+    y->height = max(heightVersion(y->left), heightVersion(y->right)) + 1;
+
+    return y;
+}
+
+int getBalanceVersion(VersionNode *node) {
+    if (node == NULL)
+        return 0;
+    return heightVersion(node->left) - heightVersion(node->right);
+}
+
+// root must already be writable
+VersionNode* rebalanceVersion(VersionNode *root) {
+    root->height = 1 + max(heightVersion(root->left), heightVersion(root->right));
+    int balance = getBalanceVersion(root);
+
+    if (balance > 1 && getBalanceVersion(root->left) >= 0)
+        return rightRotateVersion(root);
+    if (balance > 1 && getBalanceVersion(root->left) < 0) {
+        root->left = leftRotateVersion(writableVersionNode(root->left));
+        return rightRotateVersion(root);
+    }
+    if (balance < -1 && getBalanceVersion(root->right) <= 0)
+        return leftRotateVersion(root);
+    if (balance < -1 && getBalanceVersion(root->right) > 0) {
+        root->right = rightRotateVersion(writableVersionNode(root->right));
+        return leftRotateVersion(root);
+    }
+
+    return root;
+}
+
+// Inserts exp, or replaces the payload of the node with the same ID
+VersionNode* putVersion(VersionNode *root, Expense *exp) {
+    if (root == NULL)
+        return newVersionNode(exp);
+
+    root = writableVersionNode(root);
+    if (exp->expenseID < root->expenseID) {
+        root->left = putVersion(root->left, exp);
+    } else if (exp->expenseID > root->expenseID) {
+        root->right = putVersion(root->right, exp);
+    } else {
+        root->userID = exp->userID;
+        root->category = exp->category;
+        root->amount = exp->amount;
+        root->day = exp->day;
+        root->month = exp->month;
+        return root;
+    }
+    return rebalanceVersion(root);
+}
+
+VersionNode* detachMinVersion(VersionNode *root, VersionNode **min) {
+    if (root->left == NULL) {
+        *min = root;
+        return root->right;
+    }
+    root = writableVersionNode(root);
+    root->left = detachMinVersion(root->left, min);
+    return rebalanceVersion(root);
+}
+
+VersionNode* removeVersion(VersionNode *root, int expenseID) {
+    if (root == NULL)
+        return NULL;
+
+    if (expenseID < root->expenseID) {
+        root = writableVersionNode(root);
+        root->left = removeVersion(root->left, expenseID);
+    } else if (expenseID > root->expenseID) {
+        root = writableVersionNode(root);
+        root->right = removeVersion(root->right, expenseID);
+    } else {
+        VersionNode *doomed = root;
+        if (root->left == NULL || root->right == NULL) {
+            root = root->left ? root->left : root->right;
+            retireVersionNode(doomed);
+            return root;
+        }
+        VersionNode *successor;
+        VersionNode *right = detachMinVersion(root->right, &successor);
+        successor = writableVersionNode(successor);
+        successor->left = root->left;
+        successor->right = right;
+        retireVersionNode(doomed);
+        root = successor;
+    }
+    return rebalanceVersion(root);
+}
+
+VersionNode* buildVersionTree(Expense **nodes, int lo, int hi) {
+    if (lo > hi) return NULL;
+    int mid = lo + (hi - lo) / 2;
+    VersionNode *root = newVersionNode(nodes[mid]);
+    root->left = buildVersionTree(nodes, lo, mid - 1);
+    root->right = buildVersionTree(nodes, mid + 1, hi);
+    root->height = 1 + max(heightVersion(root->left), heightVersion(root->right));
+    return root;
+}
+
+// Days since 1900 in local time; exact for 1901-2099
+int calendarDay(time_t t) {
+    struct tm *tm = localtime(&t);
+    return tm->tm_yday + 365 * tm->tm_year + (tm->tm_year - 1) / 4;
+}
+
+// Whether a kept version v with from <= v < to exists, which is what can
+// still reach a node born in version from and retired while building to
+bool versionAlive(uint64_t from, uint64_t to) {
+    int lo = 0, hi = versionCount;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (versions[mid].id < from)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < versionCount && versions[lo].id < to;
+}
+
+// Drops versions outside the retention policy and frees retired nodes no
+// remaining version can reach. Kept are the newest RETAINED_VERSIONS, the
+// last version of each of the past RETAINED_DAYS days, and pinned ones.
+// Nodes retired in order are freed from the front of the queue; the ones
+// held back only by an older day's version are found by a full sweep, run
+// whenever the queue has doubled since the previous one.
+void reclaimVersions() {
+    int today = versionCount > 0 ? versions[versionCount - 1].day : 0;
+    int keep = 0;
+    for (int i = 0; i < versionCount; i++) {
+        bool recent = (i >= versionCount - RETAINED_VERSIONS);
+        bool endOfDay = (i + 1 < versionCount && versions[i + 1].day != versions[i].day &&
+                         today - versions[i].day < RETAINED_DAYS);
+        if (recent || endOfDay || versions[i].pins > 0)
+            versions[keep++] = versions[i];
+    }
+    versionCount = keep;
+
+    uint64_t oldestLive = versionCount > 0 ? versions[0].id : buildingVersion;
+    while (retiredCount > 0 && retired[retiredHead].retiredAt <= oldestLive) {
+        free(retired[retiredHead].node);
+        retiredHead++;
+        retiredCount--;
+    }
+
+    if (retiredCount > 2 * retiredAfterSweep + 1024) {
+        int kept = 0;
+        for (int i = retiredHead; i < retiredHead + retiredCount; i++) {
+            if (versionAlive(retired[i].node->born, retired[i].retiredAt))
+                retired[kept++] = retired[i];
+            else
+                free(retired[i].node);
+        }
+        retiredHead = 0;
+        retiredCount = kept;
+        retiredAfterSweep = kept;
+    }
+}
+
+// Publishes pendingRoot as a new version
+void commitVersion() {
+    if (versionCount == versionCapacity) {
+        versionCapacity = versionCapacity ? versionCapacity * 2 : 64;
+        versions = (Version*)realloc(versions, sizeof(Version) * versionCapacity);
+    }
+    versions[versionCount].id = buildingVersion;
+    versions[versionCount].committedAt = time(NULL);
+    versions[versionCount].day = calendarDay(versions[versionCount].committedAt);
+    versions[versionCount].root = pendingRoot;
+    versions[versionCount].pins = 0;
+    versionCount++;
+    buildingVersion++;
+    reclaimVersions();
+}
+
+Version* findVersion(uint64_t id) {
+    int lo = 0, hi = versionCount - 1;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (versions[mid].id == id)
+            return &versions[mid];
+        if (versions[mid].id < id)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return NULL;
+}
+
+// Latest version committed at or before t
+Version* findVersionAsOf(time_t t) {
+    Version *found = NULL;
+    for (int i = 0; i < versionCount && versions[i].committedAt <= t; i++)
+        found = &versions[i];
+    return found;
+}
+
+// Pinned versions survive retention until unpinned. The returned id stays
+// valid, the pointer only until the next commit.
+Version* pinVersion(uint64_t id) {
+    Version *v = findVersion(id);
+    if (v != NULL)
+        v->pins++;
+    return v;
+}
+
+void unpinVersion(uint64_t id) {
+    Version *v = findVersion(id);
+    if (v != NULL && v->pins > 0)
+        v->pins--;
+    reclaimVersions();
+}
+
+// Same callback interface as traverseExpensesWithContext
+void traverseVersionWithContext(VersionNode *root, void (*handler)(Expense*, void*), void* context) {
+    if (root == NULL) return;
+    traverseVersionWithContext(root->left, handler, context);
+    Expense exp;
+    memset(&exp, 0, sizeof(Expense));
+    exp.expenseID = root->expenseID;
+    exp.userID = root->userID;
+    exp.category = root->category;
+    exp.amount = root->amount;
+    exp.day = root->day;
+    exp.month = root->month;
+    handler(&exp, context);
+    traverseVersionWithContext(root->right, handler, context);
+}
+
+// Find family by user ID
+Family* findFamilyByUserID(int userID) {
+    Family* result = NULL;
+    searchFamilies(familiesRoot, userID, &result);
+    return result;
+}
+
+// Per-user expense list: every expense is threaded onto its owner's list so
+// per-user work (cascading deletes, reports) costs O(k) instead of a scan.
+void linkUserExpense(Individual *ind, Expense *exp) {
+    exp->prevByUser = NULL;
+    exp->nextByUser = ind->expenses;
+    if (ind->expenses != NULL)
+        ind->expenses->prevByUser = exp;
+    ind->expenses = exp;
+    ind->expenseCount++;
+}
+
+void unlinkUserExpense(Individual *ind, Expense *exp) {
+    if (exp->prevByUser != NULL)
+        exp->prevByUser->nextByUser = exp->nextByUser;
+    else
+        ind->expenses = exp->nextByUser;
+    if (exp->nextByUser != NULL)
+        exp->nextByUser->prevByUser = exp->prevByUser;
+    exp->nextByUser = exp->prevByUser = NULL;
+    ind->expenseCount--;
+}
+
+// Anomaly detection: each expense is scored against its owner's running
+// statistics for the category before being added to them, so the score
+// says how unusual it was given everything seen until then. Flagged
+// expenses are threaded on their own list, which is the index queried by
+// the anomaly report. All of this is O(1) per expense.
+
+void addSpendSample(SpendStats *st, double x) {
+    st->n++;
+    double delta = x - st->mean;
+    st->mean += delta / st->n;
+    st->m2 += delta * (x - st->mean);
+}
+
+// Inverse of addSpendSample, for updates and deletes
+void removeSpendSample(SpendStats *st, double x) {
+    if (st->n <= 1) {
+        st->n = 0;
+        st->mean = 0;
+        st->m2 = 0;
+        return;
+    }
+    double oldMean = st->mean;
+    st->n--;
+    st->mean = (oldMean * (st->n + 1) - x) / st->n;
+    st->m2 -= (x - st->mean) * (x - oldMean);
+    if (st->m2 < 0)
+        st->m2 = 0;
+}
+
+double spendStdDev(const SpendStats *st) {
+    return st->n > 1 ? sqrt(st->m2 / (st->n - 1)) : 0;
+}
+
+void unflagExpense(Expense *exp) {
+    if (!exp->flagged)
+        return;
+    if (exp->prevFlagged != NULL)
+        exp->prevFlagged->nextFlagged = exp->nextFlagged;
+    else
+        flaggedExpenses = exp->nextFlagged;
+    if (exp->nextFlagged != NULL)
+        exp->nextFlagged->prevFlagged = exp->prevFlagged;
+    exp->nextFlagged = exp->prevFlagged = NULL;
+    exp->flagged = false;
+    flaggedCount--;
+}
+
+// Day of the year from 0, or -1 for an invalid date. A date later than any
+// seen so far becomes today, which rolls every window over lazily.
+int rollingDay(int day, int month) {
+    if (!isValidDate(day, month))
+        return -1;
+    int d = (month - 1) * DAYS_IN_MONTH + day - 1;
+    if (d > rollingToday)
+        rollingToday = d;
+    return d;
+}
+
+// Moves the window's end up to today one day at a time: the day leaving the
+// week comes off weekTotal and the slot of the day leaving the window is
+// emptied for reuse. A gap of a whole window just clears it.
+void advanceWindow(RollingWindow *w, int today) {
+    if (today - w->day >= ROLLING_DAYS) {
+        memset(w, 0, sizeof(RollingWindow));
+        w->day = today;
+        return;
+    }
+    while (w->day < today) {
+        w->day++;
+        w->weekTotal -= w->daily[(w->day - ROLLING_WEEK + ROLLING_DAYS) % ROLLING_DAYS];
+        w->total -= w->daily[w->day % ROLLING_DAYS];
+        w->daily[w->day % ROLLING_DAYS] = 0;
+    }
+}
+
+// O(1); a negative amount takes an expense back out. Days that already left
+// the window are ignored both ways.
+void addToWindow(RollingWindow *w, int day, float amount) {
+    if (day < 0)
+        return;
+    advanceWindow(w, rollingToday);
+    if (day <= w->day - ROLLING_DAYS)
+        return;
+    w->daily[day % ROLLING_DAYS] += amount;
+    w->total += amount;
+    if (day > w->day - ROLLING_WEEK)
+        w->weekTotal += amount;
+}
+
+void addRollingSpend(Individual *ind, Expense *exp, float amount) {
+    int day = rollingDay(exp->day, exp->month);
+    if (ind != NULL)
+        addToWindow(&ind->rolling, day, amount);
+    for (int c = exp->category; isValidCategory(c); c = categoryTable[c].parent)
+        addToWindow(&categoryRolling[c], day, amount);
+}
+
+// Scores exp, flags it if unusual and adds it to the owner's statistics
+void trackSpending(Individual *ind, Expense *exp) {
+    SpendStats *st = (SpendStats*)categoryMapGet(&ind->spend, exp->category, sizeof(SpendStats));
+    // A history of identical amounts has no spread; the floor lets any
+    // real departure from it still score
+    double sd = fmax(spendStdDev(st), fmax(ANOMALY_MIN_SPREAD * fabs(st->mean), 0.01));
+
+    exp->anomalyScore = 0;
+    exp->flagged = false;
+    exp->nextFlagged = exp->prevFlagged = NULL;
+    if (st->n >= ANOMALY_MIN_HISTORY)
+        exp->anomalyScore = (float)((exp->amount - st->mean) / sd);
+
+    if (exp->anomalyScore >= ANOMALY_THRESHOLD) {
+        exp->flagged = true;
+        exp->nextFlagged = flaggedExpenses;
+        if (flaggedExpenses != NULL)
+            flaggedExpenses->prevFlagged = exp;
+        flaggedExpenses = exp;
+        flaggedCount++;
+    }
+    addSpendSample(st, exp->amount);
+    addRollingSpend(ind, exp, exp->amount);
+}
+
+// Takes exp out of the statistics and the flagged list; ind may be NULL
+void untrackSpending(Individual *ind, Expense *exp) {
+    SpendStats *st = NULL;
+    if (ind != NULL)
+        st = (SpendStats*)categoryMapFind(&ind->spend, exp->category, sizeof(SpendStats));
+    if (st != NULL)
+        removeSpendSample(st, exp->amount);
+    unflagExpense(exp);
+    addRollingSpend(ind, exp, -exp->amount);
+}
+
+// Change journal. Appending is O(1): when the ring is full the oldest entry
+// is written to the spill file, which is truncated at the start of each
+// session because name handles are only valid within one session.
+
+void beginJournalOp() {
+    journalOp++;
+}
+
+// For changes the journal does not record (budgets, categories): undo
+// stops at the current operation instead of silently reversing an older one
+void journalBarrier() {
+    mutationCount++;
+    if (!journalPaused)
+        journalBarrierOp = journalOp;
+}
+
+JournalEntry* appendJournal(JournalKind kind, int recordID) {
+    mutationCount++;
+    if (journalPaused)
+        return NULL;
+    if (journalCount == JOURNAL_CAPACITY) {
+        JournalEntry *oldest = &journal[journalHead];
+        if (journalFile == NULL)
+            journalFile = fopen(JOURNAL_FILE, "w+b");
+        if (journalFile != NULL)
+            fwrite(oldest, sizeof(JournalEntry), 1, journalFile);
+        journalSpilledOp = oldest->op;
+        journalHead = (journalHead + 1) % JOURNAL_CAPACITY;
+        journalCount--;
+    }
+    JournalEntry *entry = &journal[(journalHead + journalCount) % JOURNAL_CAPACITY];
+    journalCount++;
+    memset(entry, 0, sizeof(JournalEntry));
+    entry->op = journalOp;
+    entry->kind = kind;
+    entry->recordID = recordID;
+    entry->loggedAt = time(NULL);
+    return entry;
+}
+
+void journalExpense(JournalKind kind, Expense *exp) {
+    JournalEntry *entry = appendJournal(kind, exp->expenseID);
+    if (entry == NULL)
+        return;
+    entry->before.expense.userID = exp->userID;
+    entry->before.expense.category = exp->category;
+    entry->before.expense.amount = exp->amount;
+    entry->before.expense.day = exp->day;
+    entry->before.expense.month = exp->month;
+}
+
+void journalIndividual(JournalKind kind, Individual *ind) {
+    JournalEntry *entry = appendJournal(kind, ind->userID);
+    if (entry == NULL)
+        return;
+    Family *family = findFamilyByUserID(ind->userID);
+    entry->before.individual.name = ind->userName;
+    entry->before.individual.income = ind->income;
+    entry->before.individual.familyID = family ? family->familyID : -1;
+}
+
+void journalFamily(JournalKind kind, Family *family) {
+    JournalEntry *entry = appendJournal(kind, family->familyID);
+    if (entry == NULL)
+        return;
+    entry->before.family.name = family->familyName;
+    entry->memberCount = family->memberCount;
+    memcpy(entry->before.family.members, family->members, sizeof(family->members));
+}
+
+void journalRule(JournalKind kind, RecurringRule *rule) {
+    JournalEntry *entry = appendJournal(kind, rule->ruleID);
+    if (entry == NULL)
+        return;
+    entry->before.rule.userID = rule->userID;
+    entry->before.rule.category = rule->category;
+    entry->before.rule.amount = rule->amount;
+    entry->before.rule.day = rule->day;
+    entry->before.rule.startMonth = rule->startMonth;
+    entry->before.rule.endMonth = rule->endMonth;
+    entry->before.rule.postedThrough = rule->postedThrough;
+}
+
+// Redo records for the replica, one line each:
+//   E seq ms id user category amount day month   expense added or updated
+//   D seq ms id                                  expense deleted
+//   U seq ms userID income name                  user added or updated
+//   X seq ms userID                              user deleted (cascades)
+//   F seq ms familyID count members... name      family created or changed
+//   G seq ms familyID                            family deleted
+//   C seq ms categoryID parent name              category added
+//   R seq ms ruleID user category amount day first last posted
+//                                                recurring rule added or changed
+//   S seq ms ruleID                              recurring rule deleted
+// ms is the primary's monotonic clock, which the replica uses for lag.
+// Records are upserts or idempotent deletes, so replaying a log over a
+// snapshot that already contains some of it converges to the same state.
+
+void shipExpense(Expense *exp) {
+    if (replicationLog == NULL) return;
+    fprintf(replicationLog, "E %llu %.3f %d %d %d %.2f %d %d\n", ++replicationSeq, nowMs(),
+            exp->expenseID, exp->userID, exp->category, exp->amount, exp->day, exp->month);
+}
+
+void shipExpenseDelete(int expenseID) {
+    if (replicationLog == NULL) return;
+    fprintf(replicationLog, "D %llu %.3f %d\n", ++replicationSeq, nowMs(), expenseID);
+}
+
+void shipIndividual(Individual *ind) {
+    if (replicationLog == NULL) return;
+    fprintf(replicationLog, "U %llu %.3f %d %.2f %s\n", ++replicationSeq, nowMs(),
+            ind->userID, ind->income, nameOf(ind->userName));
+}
+
+void shipIndividualDelete(int userID) {
+    if (replicationLog == NULL) return;
+    fprintf(replicationLog, "X %llu %.3f %d\n", ++replicationSeq, nowMs(), userID);
+}
+
+void shipFamily(Family *family) {
+    if (replicationLog == NULL) return;
+    fprintf(replicationLog, "F %llu %.3f %d %d", ++replicationSeq, nowMs(),
+            family->familyID, family->memberCount);
+    for (int i = 0; i < family->memberCount; i++)
+        fprintf(replicationLog, " %d", family->members[i]);
+    fprintf(replicationLog, " %s\n", nameOf(family->familyName));
+}
+
+void shipFamilyDelete(int familyID) {
+    if (replicationLog == NULL) return;
+    fprintf(replicationLog, "G %llu %.3f %d\n", ++replicationSeq, nowMs(), familyID);
+}
+
+void shipCategory(int category) {
+    if (replicationLog == NULL) return;
+    fprintf(replicationLog, "C %llu %.3f %d %d %s\n", ++replicationSeq, nowMs(), category,
+            categoryTable[category].parent, categoryName(category));
+}
+
+void shipRule(RecurringRule *rule) {
+    if (replicationLog == NULL) return;
+    fprintf(replicationLog, "R %llu %.3f %d %d %d %.2f %d %d %d %d\n", ++replicationSeq, nowMs(),
+            rule->ruleID, rule->userID, rule->category, rule->amount, rule->day,
+            rule->startMonth, rule->endMonth, rule->postedThrough);
+}
+
+void shipRuleDelete(int ruleID) {
+    if (replicationLog == NULL) return;
+    fprintf(replicationLog, "S %llu %.3f %d\n", ++replicationSeq, nowMs(), ruleID);
+}
+
+// Budgets. Each family keeps running totals per category, rolled up into
+// the parent categories, next to totalExpense; every expense mutation
+// adjusts them and checks only the budgets of the category it touched, its
+// parents and the family total. Crossing BUDGET_WARN_PCT or 100% writes an
+// alert once; dropping back below re-arms it.
+
+float familySpend(Family *family, int slot) {
+    return slot == FAMILY_TOTAL ? family->totalExpense : categoryAmount(&family->categoryExpense, slot);
+}
+
+Budget* familyBudget(Family *family, int slot) {
+    return (Budget*)categoryMapFind(&family->budgets, slot, sizeof(Budget));
+}
+
+const char* budgetSlotName(int slot) {
+    return slot == FAMILY_TOTAL ? "Total" : categoryName(slot);
+}
+
+int budgetLevel(Family *family, int slot) {
+    Budget *budget = familyBudget(family, slot);
+    float limit = budget ? budget->limit : 0;
+    if (limit <= 0)
+        return 0;
+    float spent = familySpend(family, slot);
+    if (spent >= limit)
+        return 2;
+    if (spent * 100 >= limit * BUDGET_WARN_PCT)
+        return 1;
+    return 0;
+}
+
+void emitBudgetAlert(Family *family, int slot, int level) {
+    const char *what = budgetSlotName(slot);
+    float spent = familySpend(family, slot);
+    float limit = familyBudget(family, slot)->limit;
+    float pct = spent * 100 / limit;
+    char stamp[32];
+    time_t now = time(NULL);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&now));
+
+    if (alertLog == NULL)
+        alertLog = fopen(ALERT_LOG, "a");
+    if (alertLog != NULL) {
+        fprintf(alertLog, "%s family %d (%s) %s %s: spent %.2f of %.2f (%.0f%%)\n", stamp,
+                family->familyID, nameOf(family->familyName), what,
+                level == 2 ? "EXCEEDED" : "WARNING", spent, limit, pct);
+        fflush(alertLog);
+    }
+    printf("\nBudget alert: family %s %s spending at %.0f%% of budget (%.2f of %.2f)\n",
+           nameOf(family->familyName), what, pct, spent, limit);
+}
+
+void checkBudget(Family *family, int slot) {
+    Budget *budget = familyBudget(family, slot);
+    if (budget == NULL)
+        return;
+    int level = budgetLevel(family, slot);
+    if (level > budget->alertLevel && !replicaMode)
+        emitBudgetAlert(family, slot, level);
+    budget->alertLevel = level;
+}
+
+// Budgets that spending in category counts against
+void checkCategoryBudgets(Family *family, int category) {
+    if (family->budgets.count == 0)
+        return;
+    for (int c = category; isValidCategory(c); c = categoryTable[c].parent)
+        checkBudget(family, c);
+    checkBudget(family, FAMILY_TOTAL);
+}
+
+// Adjusts the family's running totals; the caller checks the budgets
+void applyFamilySpend(Family *family, int category, float delta) {
+    family->totalExpense += delta;
+    rollUpCategoryAmount(&family->categoryExpense, category, delta);
+}
+
+void addFamilySpend(Family *family, int category, float delta) {
+    applyFamilySpend(family, category, delta);
+    checkCategoryBudgets(family, category);
+}
+
+// Sets the alert levels to the current state without reporting, after
+// totals were rebuilt or a budget changed
+void settleBudgets(Family *family) {
+    for (int i = 0; i < family->budgets.count; i++) {
+        Budget *budget = (Budget*)categoryMapAt(&family->budgets, i, sizeof(Budget));
+        budget->alertLevel = budgetLevel(family, family->budgets.keys[i]);
+    }
+}
+
+// Adds already summed spend and day-weighted spend for one month and
+// category; lastDay is the latest day among the positive amounts
+void addFamilyTrendSums(Family *family, int month, int category, float spend, float daySpend, int lastDay) {
+    TrendSums *sums = (TrendSums*)categoryMapGet(&family->trend, (month - 1) * MAX_CATEGORIES + category,
+                                                 sizeof(TrendSums));
+    sums->spend += spend;
+    sums->daySpend += daySpend;
+    if (lastDay > family->trendLastDay[month - 1])
+        family->trendLastDay[month - 1] = lastDay;
+}
+
+// O(log n) per expense in the family's categories; a negative amount takes
+// an expense back out. Callers that change a member's expenses move the
+// family's generation themselves, rebuilds from the same data do not.
+void addFamilyTrend(Family *family, int category, int day, int month, float amount) {
+    if (month < 1 || month > MONTHS_IN_YEAR || day < 1 || day > DAYS_IN_MONTH ||
+        !isValidCategory(category))
+        return;
+    addToWindow(&family->rolling, rollingDay(day, month), amount);
+    addFamilyTrendSums(family, month, category, amount, amount * day, amount > 0 ? day : 0);
+}
+
+typedef struct {
+    float spent;        // up to and including the last observed day
+    float perDay;       // fitted daily spend at the last observed day
+    float projected;    // at month end
+} Forecast;
+
+// Fits y = a + b*d by least squares to the daily totals of days 1..t and
+// extends the line over the rest of the month. The sums over d have closed
+// forms, so only the two running sums are needed.
+Forecast forecastSpend(float spend, float daySpend, int t) {
+    Forecast f = {spend, 0, spend};
+    if (t <= 0)
+        return f;
+    double n = t;
+    double sumD = n * (n + 1) / 2;
+    double sumDD = n * (n + 1) * (2 * n + 1) / 6;
+    double slope = 0;
+    if (t > 1)
+        slope = (n * daySpend - sumD * spend) / (n * sumDD - sumD * sumD);
+    double intercept = (spend - slope * sumD) / n;
+
+    double restDays = DAYS_IN_MONTH - t;
+    double restSumD = (double)DAYS_IN_MONTH * (DAYS_IN_MONTH + 1) / 2 - sumD;
+    double remaining = intercept * restDays + slope * restSumD;
+    f.perDay = (float)fmax(intercept + slope * t, 0);
+    if (remaining > 0)
+        f.projected = spend + (float)remaining;
+    return f;
+}
+
+// The forecast of the i-th entry of the family's trend map
+Forecast forecastTrendEntry(Family *family, int i) {
+    TrendSums *sums = (TrendSums*)categoryMapAt(&family->trend, i, sizeof(TrendSums));
+    int month = family->trend.keys[i] / MAX_CATEGORIES + 1;
+    return forecastSpend(sums->spend, sums->daySpend, family->trendLastDay[month - 1]);
+}
+
+// Entries of one month are adjacent in the trend map: [*first, *last)
+void trendMonthRange(Family *family, int month, int *first, int *last) {
+    *first = categoryMapSlot(&family->trend, (month - 1) * MAX_CATEGORIES);
+    *last = categoryMapSlot(&family->trend, month * MAX_CATEGORIES);
+}
+
+// Every expense insert goes through here so the tree, the owner's list and
+// the family totals stay in step. Returns NULL for a duplicate ID or unknown user.
+Expense* addExpenseRecord(int expenseID, int userID, int category, float amount, int day, int month) {
+    Individual *ind = searchIndividual(individualsRoot, userID);
+    if (ind == NULL || searchExpense(expensesRoot, expenseID) != NULL)
+        return NULL;
+
+    expensesRoot = insertExpense(expensesRoot, expenseID, userID, category, amount, day, month);
+    Expense *exp = searchExpense(expensesRoot, expenseID);
+    linkUserExpense(ind, exp);
+    trackSpending(ind, exp);
+    indexExpense(exp);
+    pendingRoot = putVersion(pendingRoot, exp);
+    commitVersion();
+    journalExpense(JOURNAL_EXPENSE_ADD, exp);
+    shipExpense(exp);
+    placeShardExpense(exp);
+
+    // Update family expense if user is in a family
+    Family* family = findFamilyByUserID(userID);
+    if (family != NULL) {
+        touchFamily(family);
+        addFamilySpend(family, category, amount);
+        addFamilyTrend(family, category, day, month, amount);
+    }
+    return exp;
+}
+
+// In-place edit of an expense; pass the current value for fields that stay
+void updateExpenseRecord(Expense *exp, int category, float amount, int day, int month) {
+    journalExpense(JOURNAL_EXPENSE_UPDATE, exp);
+    // Rescored against the history without its old value
+    Individual *ind = searchIndividual(individualsRoot, exp->userID);
+    untrackSpending(ind, exp);
+    bool reindex = (category != exp->category || amount != exp->amount ||
+                    day != exp->day || month != exp->month);
+    if (reindex)
+        unindexExpense(exp);
+
+    // Update family totals if needed
+    Family* family = findFamilyByUserID(exp->userID);
+    if (family != NULL && category == exp->category) {
+        if (amount != exp->amount)
+            addFamilySpend(family, category, amount - exp->amount);
+    } else if (family != NULL) {
+        applyFamilySpend(family, exp->category, -exp->amount);
+        applyFamilySpend(family, category, amount);
+        checkCategoryBudgets(family, exp->category);
+        checkCategoryBudgets(family, category);
+    }
+    if (family != NULL) {
+        touchFamily(family);
+        addFamilyTrend(family, exp->category, exp->day, exp->month, -exp->amount);
+        addFamilyTrend(family, category, day, month, amount);
+    }
+    if (amount != exp->amount) {
+        exp->amount = amount;
+        refreshExpensePath(expensesRoot, exp->expenseID);
+    }
+    exp->category = category;
+    exp->day = day;
+    exp->month = month;
+
+    if (reindex)
+        indexExpense(exp);
+    if (ind != NULL)
+        trackSpending(ind, exp);
+    pendingRoot = putVersion(pendingRoot, exp);
+    commitVersion();
+    shipExpense(exp);
+}
+
+// Counterpart of addExpenseRecord; exp is freed
+void removeExpenseRecord(Expense *exp) {
+    journalExpense(JOURNAL_EXPENSE_DELETE, exp);
+    shipExpenseDelete(exp->expenseID);
+    dropShardExpense(exp);
+    Individual *ind = searchIndividual(individualsRoot, exp->userID);
+    if (ind != NULL)
+        unlinkUserExpense(ind, exp);
+    untrackSpending(ind, exp);
+    unindexExpense(exp);
+
+    Family* family = findFamilyByUserID(exp->userID);
+    if (family != NULL) {
+        touchFamily(family);
+        addFamilySpend(family, exp->category, -exp->amount);
+        addFamilyTrend(family, exp->category, exp->day, exp->month, -exp->amount);
+    }
+    pendingRoot = removeVersion(pendingRoot, exp->expenseID);
+    commitVersion();
+    expensesRoot = deleteExpense(expensesRoot, exp->expenseID);
+}
+
+// Removes all of a user's expenses in O(k log N) by walking their list.
+// Budgets are settled once for the whole batch. Returns the count.
+int deleteUserExpenses(Individual *ind, Family *family) {
+    int removed = 0;
+    if (ind->expenses != NULL)
+        touchFamily(family);
+
+    Expense *exp = ind->expenses;
+    while (exp != NULL) {
+        Expense *next = exp->nextByUser;
+        if (family != NULL) {
+            applyFamilySpend(family, exp->category, -exp->amount);
+            addFamilyTrend(family, exp->category, exp->day, exp->month, -exp->amount);
+        }
+        journalExpense(JOURNAL_EXPENSE_DELETE, exp);
+        dropShardExpense(exp);
+        untrackSpending(ind, exp);
+        unindexExpense(exp);
+        pendingRoot = removeVersion(pendingRoot, exp->expenseID);
+        expensesRoot = deleteExpense(expensesRoot, exp->expenseID);
+        removed++;
+        exp = next;
+    }
+    ind->expenses = NULL;
+    ind->expenseCount = 0;
+    if (removed > 0)
+        commitVersion();
+
+    if (family != NULL)
+        settleBudgets(family);
+    return removed;
+}
+
+RecurringRule* addRecurringRule(int userID, int category, float amount, int day, int startMonth, int endMonth) {
+    if (ruleCount == ruleCapacity) {
+        ruleCapacity = ruleCapacity ? ruleCapacity * 2 : 16;
+        rules = (RecurringRule*)realloc(rules, sizeof(RecurringRule) * ruleCapacity);
+    }
+    RecurringRule *rule = &rules[ruleCount++];
+    touchFamily(findFamilyByUserID(userID));
+    rule->ruleID = nextRuleID++;
+    rule->userID = userID;
+    rule->category = category;
+    rule->amount = amount;
+    rule->day = day;
+    rule->startMonth = startMonth;
+    rule->endMonth = endMonth;
+    rule->postedThrough = startMonth - 1;
+    return rule;
+}
+
+RecurringRule* findRecurringRule(int ruleID) {
+    for (int i = 0; i < ruleCount; i++)
+        if (rules[i].ruleID == ruleID)
+            return &rules[i];
+    return NULL;
+}
+
+bool removeRecurringRule(int ruleID) {
+    for (int i = 0; i < ruleCount; i++) {
+        if (rules[i].ruleID == ruleID) {
+            touchFamily(findFamilyByUserID(rules[i].userID));
+            journalRule(JOURNAL_RULE_DELETE, &rules[i]);
+            shipRuleDelete(ruleID);
+            memmove(&rules[i], &rules[i + 1], sizeof(RecurringRule) * (ruleCount - i - 1));
+            ruleCount--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void removeUserRules(int userID) {
+    touchFamily(findFamilyByUserID(userID));
+    int keep = 0;
+    for (int i = 0; i < ruleCount; i++) {
+        if (rules[i].userID != userID)
+            rules[keep++] = rules[i];
+        else
+            journalRule(JOURNAL_RULE_DELETE, &rules[i]);
+    }
+    ruleCount = keep;
+}
+
+// Puts a deleted rule back under its old ID, in creation order
+RecurringRule* restoreRecurringRule(int ruleID, int userID, int category, float amount, int day,
+                                    int startMonth, int endMonth, int postedThrough) {
+    RecurringRule *rule = addRecurringRule(userID, category, amount, day, startMonth, endMonth);
+    rule->ruleID = ruleID;
+    rule->postedThrough = postedThrough;
+    if (nextRuleID <= ruleID)
+        nextRuleID = ruleID + 1;
+
+    RecurringRule restored = *rule;
+    int i = ruleCount - 1;
+    while (i > 0 && rules[i - 1].ruleID > ruleID) {
+        rules[i] = rules[i - 1];
+        i--;
+    }
+    rules[i] = restored;
+    return &rules[i];
+}
+
+// Deletes a family. Its members stay on as individuals with their
+// expenses, which move back to their own shards.
+void removeFamilyRecord(Family *family) {
+    journalFamily(JOURNAL_FAMILY_DELETE, family);
+    shipFamilyDelete(family->familyID);
+    for (int i = 0; i < family->memberCount; i++)
+        routeUser(family->members[i], NULL);
+    dropIndexedName(family->familyName);
+    familiesRoot = deleteFamily(familiesRoot, family->familyID);
+}
+
+// Deletes a user together with their expenses and family membership. A
+// family left without members goes as well. Returns the expenses removed.
+int removeIndividualRecord(Individual *ind) {
+    int userID = ind->userID;
+    Family* family = findFamilyByUserID(userID);
+    int removed = deleteUserExpenses(ind, family);
+    // Logged after the expenses so undo restores the user before them
+    journalIndividual(JOURNAL_INDIVIDUAL_DELETE, ind);
+    shipIndividualDelete(userID);
+
+    if (family != NULL) {
+        if (removeFamilyMember(family, userID)) {
+            family->totalIncome -= ind->income;
+        }
+        if (family->memberCount == 0) {
+            journalFamily(JOURNAL_FAMILY_DELETE, family);
+            dropIndexedName(family->familyName);
+            familiesRoot = deleteFamily(familiesRoot, family->familyID);
+        }
+    }
+
+    removeUserRules(userID);
+    dropIndexedName(ind->userName);
+    individualsRoot = deleteIndividual(individualsRoot, userID);
+    return removed;
+}
+
+// Restores the before-image of one journal entry. Returns false if the
+// record it refers to has changed in a way that prevents it.
+bool undoJournalEntry(JournalEntry *entry) {
+    if (entry->kind <= JOURNAL_EXPENSE_DELETE) {
+        Expense *exp = searchExpense(expensesRoot, entry->recordID);
+        if (entry->kind == JOURNAL_EXPENSE_DELETE)
+            return exp == NULL &&
+                   addExpenseRecord(entry->recordID, entry->before.expense.userID,
+                                    entry->before.expense.category, entry->before.expense.amount,
+                                    entry->before.expense.day, entry->before.expense.month) != NULL;
+        if (exp == NULL)
+            return false;
+        if (entry->kind == JOURNAL_EXPENSE_ADD)
+            removeExpenseRecord(exp);
+        else
+            updateExpenseRecord(exp, entry->before.expense.category, entry->before.expense.amount,
+                                entry->before.expense.day, entry->before.expense.month);
+        return true;
+    }
+
+    if (entry->kind == JOURNAL_INDIVIDUAL_ADD) {
+        // Expenses added later are undone first; any left mean one failed
+        Individual *ind = searchIndividual(individualsRoot, entry->recordID);
+        if (ind == NULL || ind->expenseCount > 0)
+            return false;
+        removeIndividualRecord(ind);
+        return true;
+    }
+    if (entry->kind == JOURNAL_INDIVIDUAL_UPDATE) {
+        Individual *ind = searchIndividual(individualsRoot, entry->recordID);
+        if (ind == NULL)
+            return false;
+        Family *family = findFamilyByUserID(ind->userID);
+        if (family != NULL)
+            family->totalIncome += entry->before.individual.income - ind->income;
+        setIndividualName(ind, entry->before.individual.name);
+        ind->income = entry->before.individual.income;
+        shipIndividual(ind);
+        return true;
+    }
+    if (entry->kind == JOURNAL_INDIVIDUAL_DELETE) {
+        if (searchIndividual(individualsRoot, entry->recordID) != NULL)
+            return false;
+        individualsRoot = insertIndividual(individualsRoot, entry->recordID,
+                                           (char*)nameOf(entry->before.individual.name),
+                                           entry->before.individual.income);
+        shipIndividual(searchIndividual(individualsRoot, entry->recordID));
+        Family *family = searchFamily(familiesRoot, entry->before.individual.familyID);
+        if (family != NULL && findFamilyByUserID(entry->recordID) == NULL) {
+            addFamilyMember(family, entry->recordID);
+            shipFamily(family);
+        }
+        return true;
+    }
+
+    if (entry->kind >= JOURNAL_RULE_ADD) {
+        RecurringRule *rule = findRecurringRule(entry->recordID);
+        if (entry->kind == JOURNAL_RULE_DELETE) {
+            if (rule != NULL)
+                return false;
+            shipRule(restoreRecurringRule(entry->recordID, entry->before.rule.userID,
+                                          entry->before.rule.category, entry->before.rule.amount,
+                                          entry->before.rule.day, entry->before.rule.startMonth,
+                                          entry->before.rule.endMonth, entry->before.rule.postedThrough));
+            return true;
+        }
+        if (rule == NULL)
+            return false;
+        if (entry->kind == JOURNAL_RULE_ADD)
+            return removeRecurringRule(entry->recordID);
+        // Posting only ever moves postedThrough, which is what comes back
+        touchFamily(findFamilyByUserID(rule->userID));
+        rule->postedThrough = entry->before.rule.postedThrough;
+        shipRule(rule);
+        return true;
+    }
+
+    if (entry->kind == JOURNAL_FAMILY_ADD) {
+        Family *family = searchFamily(familiesRoot, entry->recordID);
+        if (family == NULL)
+            return false;
+        removeFamilyRecord(family);
+        return true;
+    }
+    if (entry->kind == JOURNAL_FAMILY_UPDATE) {
+        Family *family = searchFamily(familiesRoot, entry->recordID);
+        if (family == NULL)
+            return false;
+        setFamilyName(family, entry->before.family.name);
+        shipFamily(family);
+        return true;
+    }
+    // JOURNAL_FAMILY_DELETE: members that still exist and have not joined
+    // another family come back with their income and expenses
+    if (searchFamily(familiesRoot, entry->recordID) != NULL)
+        return false;
+    familiesRoot = insertFamily(familiesRoot, entry->recordID, (char*)nameOf(entry->before.family.name));
+    Family *family = searchFamily(familiesRoot, entry->recordID);
+    for (int i = 0; i < entry->memberCount; i++) {
+        int userID = entry->before.family.members[i];
+        Individual *ind = searchIndividual(individualsRoot, userID);
+        if (ind == NULL || findFamilyByUserID(userID) != NULL)
+            continue;
+        addFamilyMember(family, userID);
+        for (Expense *exp = ind->expenses; exp != NULL; exp = exp->nextByUser) {
+            applyFamilySpend(family, exp->category, exp->amount);
+            addFamilyTrend(family, exp->category, exp->day, exp->month, exp->amount);
+        }
+    }
+    shipFamily(family);
+    return true;
+}
+
+// Undoes up to n of the newest operations, newest entry first. Stops at an
+// operation whose entries have partly spilled to disk, and at a barrier.
+// Undo is not journaled.
+int undoJournal(int n, int *failed) {
+    int undone = 0;
+    *failed = 0;
+    journalPaused = true;
+    while (undone < n && journalCount > 0) {
+        uint32_t op = journal[(journalHead + journalCount - 1) % JOURNAL_CAPACITY].op;
+        if (op <= journalSpilledOp || op <= journalBarrierOp)
+            break;
+        while (journalCount > 0) {
+            JournalEntry *entry = &journal[(journalHead + journalCount - 1) % JOURNAL_CAPACITY];
+            if (entry->op != op)
+                break;
+            if (!undoJournalEntry(entry))
+                (*failed)++;
+            else
+                mutationCount++;
+            journalCount--;
+        }
+        undone++;
+    }
+    journalPaused = false;
+    return undone;
+}
+
+void printJournalEntry(JournalEntry *entry) {
+    static const char *kindNames[] = {
+        "ADD", "UPDATE", "DELETE", "ADD", "UPDATE", "DELETE", "ADD", "UPDATE", "DELETE",
+        "ADD", "UPDATE", "DELETE"
+    };
+    char stamp[32];
+    time_t at = (time_t)entry->loggedAt;
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&at));
+    printf("%s op %-5u %-6s ", stamp, entry->op, kindNames[entry->kind]);
+
+    if (entry->kind <= JOURNAL_EXPENSE_DELETE) {
+        printf("user %d, %s, %.2f, %d/%d\n", entry->before.expense.userID,
+               categoryName(entry->before.expense.category), entry->before.expense.amount,
+               entry->before.expense.day, entry->before.expense.month);
+    } else if (entry->kind <= JOURNAL_INDIVIDUAL_DELETE) {
+        printf("name %s, income %.2f, family %d\n", nameOf(entry->before.individual.name),
+               entry->before.individual.income, entry->before.individual.familyID);
+    } else if (entry->kind >= JOURNAL_RULE_ADD) {
+        printf("user %d, %s, %.2f, day %d of months %d-%d, posted through %d\n",
+               entry->before.rule.userID, categoryName(entry->before.rule.category),
+               entry->before.rule.amount, entry->before.rule.day, entry->before.rule.startMonth,
+               entry->before.rule.endMonth, entry->before.rule.postedThrough);
+    } else {
+        printf("name %s, members", nameOf(entry->before.family.name));
+        for (int i = 0; i < entry->memberCount; i++)
+            printf(" %d", entry->before.family.members[i]);
+        printf("\n");
+    }
+}
+
+// Prints every journal entry of one record, oldest first: the spilled
+// entries from disk, then the ring. Returns the number found.
+int printRecordHistory(JournalKind first, JournalKind last, int recordID) {
+    int found = 0;
+    JournalEntry entry;
+    if (journalFile != NULL) {
+        fflush(journalFile);
+        rewind(journalFile);
+        while (fread(&entry, sizeof(JournalEntry), 1, journalFile) == 1) {
+            if (entry.kind >= first && entry.kind <= last && entry.recordID == recordID) {
+                printJournalEntry(&entry);
+                found++;
+            }
+        }
+        fseek(journalFile, 0, SEEK_END);
+    }
+    for (int i = 0; i < journalCount; i++) {
+        JournalEntry *e = &journal[(journalHead + i) % JOURNAL_CAPACITY];
+        if (e->kind >= first && e->kind <= last && e->recordID == recordID) {
+            printJournalEntry(e);
+            found++;
+        }
+    }
+    return found;
+}
+
+// Batch mutations: sort the batch, merge it with the in-order node list and
+// rebuild a perfectly balanced tree in one pass, instead of one root-to-leaf
+// walk and rebalance per record. Family totals, trends and budgets are
+// settled once per touched family.
+
+int countExpenses(Expense* root) {
+    if (root == NULL) return 0;
+    return 1 + countExpenses(root->left) + countExpenses(root->right);
+}
+
+void flattenExpenses(Expense* root, Expense** out, int* n) {
+    if (root == NULL) return;
+    flattenExpenses(root->left, out, n);
+    out[(*n)++] = root;
+    flattenExpenses(root->right, out, n);
+}
+
+Expense* buildExpenseTree(Expense** nodes, int lo, int hi) {
+    if (lo > hi) return NULL;
+    int mid = lo + (hi - lo) / 2;
+    Expense* root = nodes[mid];
+    root->left = buildExpenseTree(nodes, lo, mid - 1);
+    root->right = buildExpenseTree(nodes, mid + 1, hi);
+    updateExpenseNode(root);
+    return root;
+}
+
+int compareMutations(const void* a, const void* b) {
+    const ExpenseMutation* x = (const ExpenseMutation*)a;
+    const ExpenseMutation* y = (const ExpenseMutation*)b;
+    if (x->expenseID != y->expenseID)
+        return (x->expenseID < y->expenseID) ? -1 : 1;
+    return x->seq - y->seq;
+}
+
+bool isValidMutation(ExpenseMutation* m) {
+    if (m->op == BATCH_DELETE)
+        return true;
+    return isValidCategory(m->category) && isValidDate(m->day, m->month);
+}
+
+void mapFamilyMembers(Family *node, Family **familyOf) {
+    if (node == NULL) return;
+    mapFamilyMembers(node->left, familyOf);
+    for (int i = 0; i < node->memberCount; i++)
+        familyOf[node->members[i]] = node;
+    mapFamilyMembers(node->right, familyOf);
+}
+
+// The batch entry of userID's family, shared by all its members. NULL if
+// the user is in no family.
+FamilyBatch* familyBatchOf(BatchFamilies *families, int userID) {
+    if (families->batchOf[userID] != NULL)
+        return families->batchOf[userID];
+    Family *family = families->familyOf[userID];
+    if (family == NULL)
+        return NULL;
+    FamilyBatch *fb = NULL;
+    for (int i = 0; i < family->memberCount && fb == NULL; i++)
+        fb = families->batchOf[family->members[i]];
+    if (fb == NULL) {
+        fb = (FamilyBatch*)calloc(1, sizeof(FamilyBatch));
+        fb->family = family;
+        fb->next = families->touched;
+        families->touched = fb;
+    }
+    families->batchOf[userID] = fb;
+    return fb;
+}
+
+// Adds (sign 1) or takes back (sign -1) one expense in its owner's family batch
+void applyBatchSpend(BatchFamilies *families, Expense *exp, float sign) {
+    FamilyBatch *fb = familyBatchOf(families, exp->userID);
+    if (fb == NULL)
+        return;
+    float amount = sign * exp->amount;
+    *(float*)categoryMapGet(&fb->spend, exp->category, sizeof(float)) += amount;
+    if (exp->month < 1 || exp->month > MONTHS_IN_YEAR || exp->day < 1 || exp->day > DAYS_IN_MONTH ||
+        !isValidCategory(exp->category))
+        return;
+    TrendSums *sums = (TrendSums*)categoryMapGet(&fb->trend, (exp->month - 1) * MAX_CATEGORIES + exp->category,
+                                                 sizeof(TrendSums));
+    sums->spend += amount;
+    sums->daySpend += amount * exp->day;
+    if (amount > 0 && exp->day > fb->trendLastDay[exp->month - 1])
+        fb->trendLastDay[exp->month - 1] = exp->day;
+    *(float*)categoryMapGet(&fb->days, exp->month * 100 + exp->day, sizeof(float)) += amount;
+}
+
+// Applies each touched family's sums once and checks only its budgets
+void settleBatchFamilies(BatchFamilies *families) {
+    FamilyBatch *fb = families->touched;
+    while (fb != NULL) {
+        Family *family = fb->family;
+        touchFamily(family);
+        for (int i = 0; i < fb->spend.count; i++) {
+            float delta = *(float*)categoryMapAt(&fb->spend, i, sizeof(float));
+            if (delta != 0)
+                applyFamilySpend(family, fb->spend.keys[i], delta);
+        }
+        for (int i = 0; i < fb->trend.count; i++) {
+            TrendSums *sums = (TrendSums*)categoryMapAt(&fb->trend, i, sizeof(TrendSums));
+            int month = fb->trend.keys[i] / MAX_CATEGORIES + 1;
+            addFamilyTrendSums(family, month, fb->trend.keys[i] % MAX_CATEGORIES,
+                               sums->spend, sums->daySpend, fb->trendLastDay[month - 1]);
+        }
+        for (int i = 0; i < fb->days.count; i++) {
+            float amount = *(float*)categoryMapAt(&fb->days, i, sizeof(float));
+            if (amount != 0)
+                addToWindow(&family->rolling, rollingDay(fb->days.keys[i] % 100, fb->days.keys[i] / 100), amount);
+        }
+        for (int i = 0; i < family->budgets.count; i++)
+            checkBudget(family, family->budgets.keys[i]);
+
+        FamilyBatch *next = fb->next;
+        categoryMapFree(&fb->spend);
+        categoryMapFree(&fb->trend);
+        categoryMapFree(&fb->days);
+        free(fb);
+        fb = next;
+    }
+    families->touched = NULL;
+}
+
+// Applies the batch and returns per-operation counts. The batch is sorted in
+// place; when an ID appears more than once only its last record is applied.
+// Inserting an existing ID, or updating/deleting a missing one, is rejected.
+BatchResult applyExpenseBatch(ExpenseMutation* batch, int count) {
+    BatchResult result = {0, 0, 0, 0};
+    if (count <= 0) return result;
+    thawTrees();
+
+    for (int i = 0; i < count; i++)
+        batch[i].seq = i;
+    qsort(batch, count, sizeof(ExpenseMutation), compareMutations);
+
+    int existing = countExpenses(expensesRoot);
+    Expense** old = (Expense**)malloc(sizeof(Expense*) * (existing + 1));
+    Expense** merged = (Expense**)malloc(sizeof(Expense*) * (existing + count + 1));
+    BatchFamilies families = {
+        .familyOf = (Family**)calloc(MAX_USERS + 1, sizeof(Family*)),
+        .batchOf = (FamilyBatch**)calloc(MAX_USERS + 1, sizeof(FamilyBatch*)),
+        .touched = NULL
+    };
+    mapFamilyMembers(familiesRoot, families.familyOf);
+    int n = 0, m = 0;
+    flattenExpenses(expensesRoot, old, &n);
+
+    int i = 0, b = 0;
+    while (b < count) {
+        // Collapse repeated IDs to their last record
+        if (b + 1 < count && batch[b + 1].expenseID == batch[b].expenseID) {
+            result.rejected++;
+            b++;
+            continue;
+        }
+        ExpenseMutation* mut = &batch[b++];
+
+        while (i < n && old[i]->expenseID < mut->expenseID)
+            merged[m++] = old[i++];
+        Expense* cur = (i < n && old[i]->expenseID == mut->expenseID) ? old[i] : NULL;
+
+        if (!isValidMutation(mut)) {
+            result.rejected++;
+            continue;
+        }
+
+        if (mut->op == BATCH_INSERT) {
+            Individual* ind = searchIndividual(individualsRoot, mut->userID);
+            if (cur != NULL || ind == NULL || mut->expenseID < 0) {
+                result.rejected++;
+                continue;
+            }
+            Expense* exp = (Expense*)malloc(sizeof(Expense));
+            exp->expenseID = mut->expenseID;
+            exp->userID = mut->userID;
+            exp->category = mut->category;
+            exp->amount = mut->amount;
+            exp->day = mut->day;
+            exp->month = mut->month;
+            linkUserExpense(ind, exp);
+            trackSpending(ind, exp);
+            indexExpense(exp);
+            pendingRoot = putVersion(pendingRoot, exp);
+            journalExpense(JOURNAL_EXPENSE_ADD, exp);
+            shipExpense(exp);
+            placeShardExpense(exp);
+            applyBatchSpend(&families, exp, 1);
+            merged[m++] = exp;
+            result.inserted++;
+        }
+        else if (cur == NULL) {
+            result.rejected++;
+        }
+        else if (mut->op == BATCH_UPDATE) {
+            applyBatchSpend(&families, cur, -1);
+            journalExpense(JOURNAL_EXPENSE_UPDATE, cur);
+            Individual* ind = searchIndividual(individualsRoot, cur->userID);
+            untrackSpending(ind, cur);
+            unindexExpense(cur);
+            cur->category = mut->category;
+            cur->amount = mut->amount;
+            cur->day = mut->day;
+            cur->month = mut->month;
+            applyBatchSpend(&families, cur, 1);
+            indexExpense(cur);
+            if (ind != NULL)
+                trackSpending(ind, cur);
+            pendingRoot = putVersion(pendingRoot, cur);
+            shipExpense(cur);
+            merged[m++] = cur;
+            i++;
+            result.updated++;
+        }
+        else {
+            Individual* ind = searchIndividual(individualsRoot, cur->userID);
+            if (ind != NULL)
+                unlinkUserExpense(ind, cur);
+            journalExpense(JOURNAL_EXPENSE_DELETE, cur);
+            shipExpenseDelete(cur->expenseID);
+            dropShardExpense(cur);
+            untrackSpending(ind, cur);
+            unindexExpense(cur);
+            pendingRoot = removeVersion(pendingRoot, cur->expenseID);
+            applyBatchSpend(&families, cur, -1);
+            free(cur);
+            i++;
+            result.deleted++;
+        }
+    }
+    while (i < n)
+        merged[m++] = old[i++];
+
+    expensesRoot = buildExpenseTree(merged, 0, m - 1);
+    settleBatchFamilies(&families);
+    if (result.inserted + result.updated + result.deleted > 0)
+        commitVersion();
+
+    free(old);
+    free(merged);
+    free(families.familyOf);
+    free(families.batchOf);
+    return result;
+}
+
+// Builds the in-memory trees and indexes from the mapped store and releases
+// the mapping. Everything that mutates expenses or needs the secondary
+// indexes calls this first; it is a no-op once the store is warm.
+void loadExpenseTrees() {
+    if (!expenseStore.cold)
+        return;
+
+    uint32_t n = expenseStore.header->recordCount;
+    Expense** nodes = (Expense**)malloc(sizeof(Expense*) * (n + 1));
+    uint32_t m = 0;
+
+    for (uint32_t i = 0; i < n; i++) {
+        const ExpenseRecord *rec = storeRecord(i);
+        Individual *ind = searchIndividual(individualsRoot, rec->userID);
+        if (ind == NULL)
+            continue;   // owner no longer exists
+
+        Expense *exp = (Expense*)malloc(sizeof(Expense));
+        recordToExpense(rec, exp);
+        linkUserExpense(ind, exp);
+        trackSpending(ind, exp);
+        indexExpense(exp);
+        nodes[m++] = exp;
+    }
+    expensesRoot = buildExpenseTree(nodes, 0, (int)m - 1);
+    pendingRoot = buildVersionTree(nodes, 0, (int)m - 1);
+    commitVersion();
+    shardsStale = true;
+    free(nodes);
+
+    munmap(expenseStore.base, expenseStore.length);
+    expenseStore.cold = false;
+}
+
+// Replica side of log shipping
+
+typedef struct {
+    FILE *file;
+    ino_t inode;                    // the primary recreates the log on start
+    unsigned long long appliedSeq;
+    long long applied;
+    double lastLag, lagSum, lagMax;
+    double lags[LAG_SAMPLES];       // ring of recent apply lags
+    int lagCount;
+} ReplicaState;
+
+ReplicaState replica;
+pthread_mutex_t replicaLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Makes the family's member list match the primary's and recomputes its
+// totals from the members' current incomes and expenses
+void setFamilyMembers(Family *family, const int *members, int count) {
+    while (family->memberCount > 0) {
+        int userID = family->members[0];
+        Individual *ind = searchIndividual(individualsRoot, userID);
+        removeFamilyMember(family, userID);
+        if (ind != NULL)
+            family->totalIncome -= ind->income;
+    }
+    family->totalIncome = 0;
+    family->totalExpense = 0;
+    categoryMapFree(&family->categoryExpense);
+    categoryMapFree(&family->trend);
+    memset(family->trendLastDay, 0, sizeof(family->trendLastDay));
+    memset(&family->rolling, 0, sizeof(family->rolling));
+    for (int i = 0; i < count; i++) {
+        Individual *ind = searchIndividual(individualsRoot, members[i]);
+        if (ind == NULL || !addFamilyMember(family, members[i]))
+            continue;
+        for (Expense *exp = ind->expenses; exp != NULL; exp = exp->nextByUser) {
+            applyFamilySpend(family, exp->category, exp->amount);
+            addFamilyTrend(family, exp->category, exp->day, exp->month, exp->amount);
+        }
+    }
+    settleBudgets(family);
+}
+
+// Applies one redo record. Returns false for a malformed line.
+bool applyRedoRecord(char *line, unsigned long long *seq, double *sentMs) {
+    char op;
+    int n;
+    if (sscanf(line, " %c %llu %lf%n", &op, seq, sentMs, &n) != 3)
+        return false;
+    char *args = line + n;
+
+    if (op == 'E') {
+        int id, userID, category, day, month;
+        float amount;
+        if (sscanf(args, "%d %d %d %f %d %d", &id, &userID, &category, &amount, &day, &month) != 6)
+            return false;
+        Expense *exp = searchExpense(expensesRoot, id);
+        if (exp != NULL)
+            updateExpenseRecord(exp, category, amount, day, month);
+        else
+            addExpenseRecord(id, userID, category, amount, day, month);
+    }
+    else if (op == 'D') {
+        int id;
+        if (sscanf(args, "%d", &id) != 1)
+            return false;
+        Expense *exp = searchExpense(expensesRoot, id);
+        if (exp != NULL)
+            removeExpenseRecord(exp);
+    }
+    else if (op == 'U') {
+        int userID;
+        float income;
+        char name[50];
+        if (sscanf(args, "%d %f %49s", &userID, &income, name) != 3)
+            return false;
+        Individual *ind = searchIndividual(individualsRoot, userID);
+        if (ind == NULL) {
+            individualsRoot = insertIndividual(individualsRoot, userID, name, income);
+        } else {
+            Family *family = findFamilyByUserID(userID);
+            if (family != NULL)
+                family->totalIncome += income - ind->income;
+            ind->income = income;
+            setIndividualName(ind, internName(name));
+        }
+    }
+    else if (op == 'X') {
+        int userID;
+        if (sscanf(args, "%d", &userID) != 1)
+            return false;
+        Individual *ind = searchIndividual(individualsRoot, userID);
+        if (ind != NULL)
+            removeIndividualRecord(ind);
+    }
+    else if (op == 'F') {
+        int familyID, count, used;
+        int members[MAX_FAMILY_MEMBERS];
+        char name[50];
+        if (sscanf(args, "%d %d%n", &familyID, &count, &used) != 2 ||
+            count < 0 || count > MAX_FAMILY_MEMBERS)
+            return false;
+        args += used;
+        for (int i = 0; i < count; i++) {
+            if (sscanf(args, "%d%n", &members[i], &used) != 1)
+                return false;
+            args += used;
+        }
+        if (sscanf(args, "%49s", name) != 1)
+            return false;
+        Family *family = searchFamily(familiesRoot, familyID);
+        if (family == NULL) {
+            familiesRoot = insertFamily(familiesRoot, familyID, name);
+            family = searchFamily(familiesRoot, familyID);
+        }
+        setFamilyName(family, internName(name));
+        setFamilyMembers(family, members, count);
+    }
+    else if (op == 'G') {
+        int familyID;
+        if (sscanf(args, "%d", &familyID) != 1)
+            return false;
+        Family *family = searchFamily(familiesRoot, familyID);
+        if (family != NULL)
+            removeFamilyRecord(family);
+    }
+    else if (op == 'C') {
+        int category, parent;
+        char name[50];
+        if (sscanf(args, "%d %d %49s", &category, &parent, name) != 3)
+            return false;
+        // IDs are dense, so a category the snapshot already has is skipped
+        if (category == categoryCount)
+            addCategory(name, parent);
+    }
+    else if (op == 'R') {
+        RecurringRule r;
+        if (sscanf(args, "%d %d %d %f %d %d %d %d", &r.ruleID, &r.userID, &r.category, &r.amount,
+                   &r.day, &r.startMonth, &r.endMonth, &r.postedThrough) != 8)
+            return false;
+        RecurringRule *rule = findRecurringRule(r.ruleID);
+        if (rule == NULL) {
+            rule = addRecurringRule(r.userID, r.category, r.amount, r.day, r.startMonth, r.endMonth);
+            rule->ruleID = r.ruleID;
+            if (nextRuleID <= r.ruleID)
+                nextRuleID = r.ruleID + 1;
+        }
+        touchFamily(findFamilyByUserID(rule->userID));
+        *rule = r;
+        touchFamily(findFamilyByUserID(rule->userID));
+    }
+    else if (op == 'S') {
+        int ruleID;
+        if (sscanf(args, "%d", &ruleID) != 1)
+            return false;
+        removeRecurringRule(ruleID);
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+// Applies every complete record appended since the last call. A partly
+// written last line is left for the next poll. Caller holds replicaLock.
+void pollReplicationLog() {
+    struct stat st;
+    if (stat(REPLICATION_LOG, &st) != 0)
+        return;     // primary not started yet
+    if (replica.file == NULL || st.st_ino != replica.inode) {
+        if (replica.file != NULL)
+            fclose(replica.file);
+        replica.file = fopen(REPLICATION_LOG, "r");
+        if (replica.file == NULL)
+            return;
+        replica.inode = st.st_ino;
+    }
+
+    loadExpenseTrees();
+    char line[512];
+    while (1) {
+        long start = ftell(replica.file);
+        if (fgets(line, sizeof(line), replica.file) == NULL) {
+            clearerr(replica.file);
+            break;
+        }
+        if (line[strlen(line) - 1] != '\n') {
+            fseek(replica.file, start, SEEK_SET);
+            break;
+        }
+
+        unsigned long long seq;
+        double sentMs;
+        if (!applyRedoRecord(line, &seq, &sentMs))
+            continue;
+        double lag = nowMs() - sentMs;
+        replica.appliedSeq = seq;
+        replica.applied++;
+        replica.lastLag = lag;
+        replica.lagSum += lag;
+        if (lag > replica.lagMax)
+            replica.lagMax = lag;
+        replica.lags[replica.applied % LAG_SAMPLES] = lag;
+        if (replica.lagCount < LAG_SAMPLES)
+            replica.lagCount++;
+    }
+}
+
+void* tailReplicationLog(void *arg) {
+    (void)arg;
+    while (1) {
+        pthread_mutex_lock(&replicaLock);
+        pollReplicationLog();
+        pthread_mutex_unlock(&replicaLock);
+        usleep(REPLICA_POLL_US);
+    }
+    return NULL;
+}
+
+int compareDoubles(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+void printReplicationStatus() {
+    printf("\nReplication status\n");
+    printf("------------------------------------------------\n");
+    printf("Records applied:  %lld (through seq %llu)\n", replica.applied, replica.appliedSeq);
+    if (replica.applied == 0) {
+        printf("No records from the primary yet.\n\n");
+        return;
+    }
+    double sorted[LAG_SAMPLES];
+    memcpy(sorted, replica.lags, sizeof(double) * replica.lagCount);
+    qsort(sorted, replica.lagCount, sizeof(double), compareDoubles);
+    printf("Lag (ms):         last %.2f, avg %.2f, max %.2f\n",
+           replica.lastLag, replica.lagSum / replica.applied, replica.lagMax);
+    printf("Recent %d:      p50 %.2f, p99 %.2f\n", replica.lagCount,
+           sorted[replica.lagCount / 2], sorted[replica.lagCount * 99 / 100]);
+    printf("\n");
+}
+
+// Filter engine: the planner picks the cheapest access path for a query and
+// the cursor runs every predicate in one fused check per candidate row.
+
+void initExpenseQuery(ExpenseQuery *q) {
+    q->userID = -1;
+    q->family = NULL;
+    q->category = -1;
+    q->minAmount = -FLT_MAX;
+    q->maxAmount = FLT_MAX;
+    q->startDate = 0;
+    q->endDate = INT_MAX;
+    q->startID = INT_MIN;
+    q->endID = INT_MAX;
+}
+
+bool matchesQuery(const ExpenseQuery *q, const Expense *exp) {
+    int date = exp->month * 100 + exp->day;
+    return (q->userID < 0 || exp->userID == q->userID) &&
+           (q->family == NULL || isMember(q->family, exp->userID)) &&
+           (q->category < 0 || categoryWithin(exp->category, q->category)) &&
+           exp->amount >= q->minAmount && exp->amount <= q->maxAmount &&
+           date >= q->startDate && date <= q->endDate &&
+           exp->expenseID >= q->startID && exp->expenseID <= q->endID;
+}
+
+// Estimated candidate rows per path; the smallest estimate wins
+QueryPath planQuery(const ExpenseQuery *q) {
+    loadExpenseTrees();
+    QueryPath best = PATH_FULL_SCAN;
+    long bestRows = LONG_MAX;
+
+    if (q->startID != INT_MIN || q->endID != INT_MAX) {
+        int rows;
+        double ignored;
+        expenseRangeTotals(expensesRoot, q->startID, q->endID, &rows, &ignored);
+        best = PATH_ID_RANGE;
+        bestRows = rows;
+    }
+    if (q->userID >= 0) {
+        Individual *ind = searchIndividual(individualsRoot, q->userID);
+        long rows = ind ? ind->expenseCount : 0;
+        if (rows < bestRows) {
+            best = PATH_USER_LIST;
+            bestRows = rows;
+        }
+    }
+    if (q->family != NULL) {
+        long rows = 0;
+        for (int i = 0; i < q->family->memberCount; i++) {
+            Individual *ind = searchIndividual(individualsRoot, q->family->members[i]);
+            if (ind) rows += ind->expenseCount;
+        }
+        if (rows < bestRows) {
+            best = PATH_FAMILY_LISTS;
+            bestRows = rows;
+        }
+    }
+    return best;
+}
+
+const char* queryPathName(QueryPath path) {
+    switch (path) {
+        case PATH_ID_RANGE: return "expense ID range seek";
+        case PATH_USER_LIST: return "user expense list";
+        case PATH_FAMILY_LISTS: return "family member expense lists";
+        default: return "full scan";
+    }
+}
+
+// Pushes the nodes with ID >= startID on the way down, like a lower bound
+void seekExpenseCursor(QueryCursor *cur, Expense *node, int startID) {
+    while (node != NULL) {
+        if (node->expenseID >= startID) {
+            cur->stack[cur->depth++] = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+}
+
+Expense* nextTreeCandidate(QueryCursor *cur) {
+    if (cur->depth == 0) return NULL;
+    Expense *node = cur->stack[--cur->depth];
+    for (Expense *n = node->right; n != NULL; n = n->left)
+        cur->stack[cur->depth++] = n;
+    return node;
+}
+
+// Moves the family cursor to the next member that has expenses
+Expense* nextFamilyList(QueryCursor *cur) {
+    Family *family = cur->query.family;
+    while (cur->memberIndex < family->memberCount) {
+        Individual *ind = searchIndividual(individualsRoot, family->members[cur->memberIndex++]);
+        if (ind != NULL && ind->expenses != NULL)
+            return ind->expenses;
+    }
+    return NULL;
+}
+
+void openQueryWithPath(QueryCursor *cur, const ExpenseQuery *q, QueryPath path) {
+    loadExpenseTrees();
+    cur->query = *q;
+    cur->path = path;
+    cur->memberIndex = 0;
+    cur->listPos = NULL;
+    cur->depth = 0;
+    cur->scanned = 0;
+
+    if (cur->path == PATH_USER_LIST) {
+        Individual *ind = searchIndividual(individualsRoot, q->userID);
+        cur->listPos = ind ? ind->expenses : NULL;
+    } else if (cur->path == PATH_FAMILY_LISTS) {
+        cur->listPos = nextFamilyList(cur);
+    } else {
+        seekExpenseCursor(cur, expensesRoot, q->startID);
+    }
+}
+
+void openQuery(QueryCursor *cur, const ExpenseQuery *q) {
+    openQueryWithPath(cur, q, planQuery(q));
+}
+
+// Returns the next matching expense, or NULL once the query is exhausted.
+// Tree paths return rows in ID order, list paths in list order.
+Expense* nextQueryResult(QueryCursor *cur) {
+    const ExpenseQuery *q = &cur->query;
+
+    while (1) {
+        Expense *exp;
+        if (cur->path == PATH_USER_LIST || cur->path == PATH_FAMILY_LISTS) {
+            if (cur->listPos == NULL && cur->path == PATH_FAMILY_LISTS)
+                cur->listPos = nextFamilyList(cur);
+            exp = cur->listPos;
+            if (exp == NULL) return NULL;
+            cur->listPos = exp->nextByUser;
+        } else {
+            exp = nextTreeCandidate(cur);
+            if (exp == NULL || exp->expenseID > q->endID) {
+                cur->depth = 0;
+                return NULL;
+            }
+        }
+
+        cur->scanned++;
+        if (matchesQuery(q, exp))
+            return exp;
+    }
+}
+
+// Date-window pages walk the date index from the first key after
+// (afterDate, afterID) and stop past endDate, so they read only rows inside
+// the window.
+int fetchDatePage(const ExpenseQuery *q, int afterDate, int afterID, Expense **rows, int pageSize, long *nextToken) {
+    DateNode *stack[64];
+    int depth = 0;
+
+    // Seek: stack the ancestors whose key comes after the resume point
+    DateNode *node = dateIndex;
+    while (node != NULL) {
+        if (compareDateKey(afterDate, afterID, node) < 0) {
+            stack[depth++] = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+
+    int n = 0;
+    while (n < pageSize && depth > 0) {
+        node = stack[--depth];
+        if (node->date > q->endDate) {
+            depth = 0;
+            break;
+        }
+        if (matchesQuery(q, node->expense))
+            rows[n++] = node->expense;
+        for (DateNode *next = node->right; next != NULL; next = next->left)
+            stack[depth++] = next;
+    }
+
+    // Only hand out a token when rows may remain past this page
+    if (n == pageSize && depth > 0)
+        *nextToken = ((long)(rows[n - 1]->month * 100 + rows[n - 1]->day) << 31) | rows[n - 1]->expenseID;
+    return n;
+}
+
+// Pagination: a page is fetched by seeking straight to the key after the
+// continuation token and reading at most pageSize matches. Queries with a
+// date window and no ID range walk the date index in (date, ID) order and
+// the token packs the last date and expenseID; everything else walks the
+// expense tree in ID order and the token is the last expenseID. Either way
+// a page costs O(log N) plus the rows read inside the window, whatever
+// pages came before, though rows the other predicates reject are still
+// read. *nextToken is -1 once the query is exhausted.
+int fetchExpensePage(const ExpenseQuery *q, long afterID, Expense **rows, int pageSize, long *nextToken) {
+    ExpenseQuery pageQuery = *q;
+    *nextToken = -1;
+
+    if (q->startID == INT_MIN && q->endID == INT_MAX &&
+        (q->startDate > 0 || q->endDate < INT_MAX)) {
+        loadExpenseTrees();
+        if (afterID < 0)
+            return fetchDatePage(q, q->startDate, INT_MIN, rows, pageSize, nextToken);
+        int afterDate = (int)(afterID >> 31);
+        if (afterDate < q->startDate)
+            return fetchDatePage(q, q->startDate, INT_MIN, rows, pageSize, nextToken);
+        return fetchDatePage(q, afterDate, (int)(afterID & INT_MAX), rows, pageSize, nextToken);
+    }
+
+    if (afterID >= INT_MAX)
+        return 0;
+    if (afterID >= pageQuery.startID)
+        pageQuery.startID = (int)afterID + 1;
+
+    // Only the tree paths return rows in ID order, which resuming relies on
+    QueryCursor cur;
+    openQueryWithPath(&cur, &pageQuery, PATH_ID_RANGE);
+
+    int n = 0;
+    Expense *exp;
+    while (n < pageSize && (exp = nextQueryResult(&cur)) != NULL)
+        rows[n++] = exp;
+
+    if (n == pageSize)
+        *nextToken = rows[n - 1]->expenseID;
+    return n;
+}
+
+// Shard queries. Each shard has a long-lived worker thread that runs the
+// tasks handed to it over its own tree. Family-scoped reports run on the
+// one shard that holds the family, global reports fan out to every shard
+// and the results are merged.
+
+void routeFamilyMembers(Family *node) {
+    if (node == NULL) return;
+    routeFamilyMembers(node->left);
+    for (int i = 0; i < node->memberCount; i++)
+        userShard[node->members[i]] = node->familyID % shardCount;
+    routeFamilyMembers(node->right);
+}
+
+int shardOfFamily(Family *family) {
+    return family->familyID % shardCount;
+}
+
+void countShardRows(Expense *root) {
+    if (root == NULL) return;
+    countShardRows(root->left);
+    shards[shardOfUser(root->userID)].count++;
+    countShardRows(root->right);
+}
+
+// Sorts the expenses into per-shard runs in ID order; counts must be zero
+void distributeExpenses(Expense *root, Expense ***runs) {
+    if (root == NULL) return;
+    distributeExpenses(root->left, runs);
+    int shard = shardOfUser(root->userID);
+    runs[shard][shards[shard].count++] = root;
+    distributeExpenses(root->right, runs);
+}
+
+ShardNode* buildShardTree(Expense **rows, int lo, int hi) {
+    if (lo > hi) return NULL;
+    int mid = lo + (hi - lo) / 2;
+    ShardNode *node = (ShardNode*)malloc(sizeof(ShardNode));
+    node->expense = rows[mid];
+    node->left = buildShardTree(rows, lo, mid - 1);
+    node->right = buildShardTree(rows, mid + 1, hi);
+    node->height = max(heightShard(node->left), heightShard(node->right)) + 1;
+    return node;
+}
+
+// Full rebuild, only needed after the shards were marked stale. Each tree
+// is built in one go so a shard's nodes sit together in memory.
+void rebuildShards() {
+    loadExpenseTrees();
+    if (!shardsStale)
+        return;
+    for (int u = 0; u <= MAX_USERS; u++)
+        userShard[u] = u % shardCount;
+    routeFamilyMembers(familiesRoot);
+
+    for (int i = 0; i < MAX_SHARDS; i++) {
+        freeShardTree(shards[i].root);
+        shards[i].root = NULL;
+        shards[i].count = 0;
+    }
+    countShardRows(expensesRoot);
+    Expense **rows = (Expense**)malloc(sizeof(Expense*) * (countExpense(expensesRoot) + 1));
+    Expense **runs[MAX_SHARDS];
+    int offset = 0;
+    for (int i = 0; i < shardCount; i++) {
+        runs[i] = rows + offset;
+        offset += shards[i].count;
+        shards[i].count = 0;
+    }
+    distributeExpenses(expensesRoot, runs);
+    for (int i = 0; i < shardCount; i++)
+        shards[i].root = buildShardTree(runs[i], 0, shards[i].count - 1);
+    free(rows);
+    shardsStale = false;
+}
+
+void setShardCount(int n) {
+    if (n < 1) n = 1;
+    if (n > MAX_SHARDS) n = MAX_SHARDS;
+    if (n != shardCount) {
+        shardCount = n;
+        shardsStale = true;
+    }
+}
+
+// Heap order for the top-k: smaller amount, then larger ID, is "less"
+bool amountBelow(const Expense *a, const Expense *b) {
+    if (a->amount != b->amount)
+        return a->amount < b->amount;
+    return a->expenseID > b->expenseID;
+}
+
+void siftDownAmounts(Expense **heap, int n, int i) {
+    while (1) {
+        int smallest = i, l = 2 * i + 1, r = 2 * i + 2;
+        if (l < n && amountBelow(heap[l], heap[smallest])) smallest = l;
+        if (r < n && amountBelow(heap[r], heap[smallest])) smallest = r;
+        if (smallest == i) return;
+        Expense *tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+void pushTopAmount(ExpenseShard *shard, Expense *exp, int k) {
+    Expense **heap = shard->out;
+    if (shard->outCount < k) {
+        int i = shard->outCount++;
+        heap[i] = exp;
+        while (i > 0 && amountBelow(heap[i], heap[(i - 1) / 2])) {
+            Expense *tmp = heap[i];
+            heap[i] = heap[(i - 1) / 2];
+            heap[(i - 1) / 2] = tmp;
+            i = (i - 1) / 2;
+        }
+    } else if (amountBelow(heap[0], exp)) {
+        heap[0] = exp;
+        siftDownAmounts(heap, k, 0);
+    }
+}
+
+// In-order walk of a shard's tree; the query's ID range prunes subtrees
+void runShardNode(ExpenseShard *shard, ShardNode *node) {
+    if (node == NULL) return;
+    const ShardTask *task = shard->task;
+    Expense *exp = node->expense;
+    if (exp->expenseID > task->query->startID)
+        runShardNode(shard, node->left);
+    if (matchesQuery(task->query, exp)) {
+        if (task->kind == SHARD_SCAN)
+            shard->out[shard->outCount++] = exp;
+        else if (task->kind == SHARD_TOP_AMOUNTS)
+            pushTopAmount(shard, exp, task->k);
+        else
+            *(double*)categoryMapGet(&shard->categoryTotals, exp->category, sizeof(double)) += exp->amount;
+    }
+    if (exp->expenseID < task->query->endID)
+        runShardNode(shard, node->right);
+}
+
+void runShardTask(ExpenseShard *shard) {
+    const ShardTask *task = shard->task;
+    int needed = (task->kind == SHARD_TOP_AMOUNTS) ? task->k : shard->count;
+
+    shard->outCount = 0;
+    if (needed > shard->outCapacity) {
+        shard->outCapacity = needed;
+        shard->out = (Expense**)realloc(shard->out, sizeof(Expense*) * needed);
+    }
+    shard->categoryTotals.count = 0;
+    runShardNode(shard, shard->root);
+}
+
+void* shardWorker(void *arg) {
+    ExpenseShard *shard = (ExpenseShard*)arg;
+    pthread_mutex_lock(&shardLock);
+    while (1) {
+        while (shard->task == NULL)
+            pthread_cond_wait(&shardWake, &shardLock);
+        pthread_mutex_unlock(&shardLock);
+        runShardTask(shard);
+        pthread_mutex_lock(&shardLock);
+        shard->task = NULL;
+        if (--shardsBusy == 0)
+            pthread_cond_signal(&shardIdle);
+    }
+    return NULL;
+}
+
+// Hands task to the workers of shards [first, first + n) and waits for all
+// of them. The caller is blocked meanwhile, so the trees cannot change
+// under the workers. A shard whose worker cannot be started runs the task
+// on the caller's thread.
+void scatterShards(const ShardTask *task, int first, int n) {
+    pthread_mutex_lock(&shardLock);
+    for (int i = first; i < first + n; i++) {
+        ExpenseShard *shard = &shards[i];
+        if (!shard->started)
+            shard->started = (pthread_create(&shard->worker, NULL, shardWorker, shard) == 0);
+        if (shard->started) {
+            shard->task = task;
+            shardsBusy++;
+        }
+    }
+    pthread_cond_broadcast(&shardWake);
+    pthread_mutex_unlock(&shardLock);
+
+    for (int i = first; i < first + n; i++) {
+        if (!shards[i].started) {
+            shards[i].task = task;
+            runShardTask(&shards[i]);
+            shards[i].task = NULL;
+        }
+    }
+
+    pthread_mutex_lock(&shardLock);
+    while (shardsBusy > 0)
+        pthread_cond_wait(&shardIdle, &shardLock);
+    pthread_mutex_unlock(&shardLock);
+}
+
+void siftDownShards(int *heap, int n, int i, const int *headID) {
+    while (1) {
+        int smallest = i, l = 2 * i + 1, r = 2 * i + 2;
+        if (l < n && headID[heap[l]] < headID[heap[smallest]]) smallest = l;
+        if (r < n && headID[heap[r]] < headID[heap[smallest]]) smallest = r;
+        if (smallest == i) return;
+        int tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+// Scatter-gather scan; rows are merged back into ID order. Returns the
+// number of rows written to out, which must hold every expense.
+int shardedScan(const ExpenseQuery *q, Expense **out) {
+    rebuildShards();
+    ShardTask task = { .kind = SHARD_SCAN, .query = q, .k = 0 };
+    scatterShards(&task, 0, shardCount);
+
+    // k-way merge with a min-heap of shard indexes keyed by their next ID
+    int pos[MAX_SHARDS] = {0};
+    int headID[MAX_SHARDS];
+    int heap[MAX_SHARDS];
+    int heapSize = 0;
+    for (int i = 0; i < shardCount; i++) {
+        if (shards[i].outCount > 0) {
+            headID[i] = shards[i].out[0]->expenseID;
+            heap[heapSize++] = i;
+        }
+    }
+    for (int i = heapSize / 2 - 1; i >= 0; i--)
+        siftDownShards(heap, heapSize, i, headID);
+
+    int n = 0;
+    while (heapSize > 0) {
+        int s = heap[0];
+        out[n++] = shards[s].out[pos[s]++];
+        if (pos[s] == shards[s].outCount)
+            heap[0] = heap[--heapSize];
+        else
+            headID[s] = shards[s].out[pos[s]]->expenseID;
+        siftDownShards(heap, heapSize, 0, headID);
+    }
+    return n;
+}
+
+int compareAmountsDesc(const void *a, const void *b) {
+    const Expense *x = *(const Expense**)a;
+    const Expense *y = *(const Expense**)b;
+    if (amountBelow(x, y)) return 1;
+    if (amountBelow(y, x)) return -1;
+    return 0;
+}
+
+// Each shard keeps its own top k, the union is sorted and cut to k.
+// out must hold k rows.
+int shardedTopAmounts(const ExpenseQuery *q, int k, Expense **out) {
+    rebuildShards();
+    if (k <= 0) return 0;
+    ShardTask task = { .kind = SHARD_TOP_AMOUNTS, .query = q, .k = k };
+    scatterShards(&task, 0, shardCount);
+
+    Expense **all = (Expense**)malloc(sizeof(Expense*) * k * shardCount);
+    int n = 0;
+    for (int i = 0; i < shardCount; i++)
+        for (int j = 0; j < shards[i].outCount; j++)
+            all[n++] = shards[i].out[j];
+    qsort(all, n, sizeof(Expense*), compareAmountsDesc);
+    if (n > k) n = k;
+    memcpy(out, all, sizeof(Expense*) * n);
+    free(all);
+    return n;
+}
+
+// Family reports only touch the shard that owns the family. The totals
+// belong to the shard and are valid until its next task.
+const CategoryMap* shardedFamilyTotals(Family *family) {
+    rebuildShards();
+    ExpenseQuery q;
+    initExpenseQuery(&q);
+    q.family = family;
+    ShardTask task = { .kind = SHARD_CATEGORY_TOTALS, .query = &q, .k = 0 };
+    int shard = shardOfFamily(family);
+    scatterShards(&task, shard, 1);
+    return &shards[shard].categoryTotals;
+}
+
+// Required functions
+void Add_User() {
+    int userID;
+    char userName[50];
+    float income;
+    
+    while (1) {
+        printf("Enter User ID(1-1000): ");
+        scanf("%d", &userID);
+        
+        if (userID < 0 || userID > 1000) {
+            printf("Error: Invalid User ID. Please enter a valid userid(1-1000).\n");
+            continue;
+        }
+        
+        if (searchIndividual(individualsRoot, userID) != NULL) {
+            printf("Error: User ID %d already exists. Please enter a different ID.\n", userID);
+            continue;
+        }
+        
+        // Check if user is already in any family
+        Family* existingFamily = NULL;
+        searchFamilies(familiesRoot, userID, &existingFamily);
+        if (existingFamily != NULL) {
+            printf("Error: User ID %d is already a member of family %s. Please enter a different ID.\n", 
+                  userID, nameOf(existingFamily->familyName));
+            continue;
+        }
+        
+        break;
+    }
+    
+    printf("Enter User Name: ");
+    scanf("%s", userName);
+    printf("Enter Income: ");
+    scanf("%f", &income);
+    
+    individualsRoot = insertIndividual(individualsRoot, userID, userName, income);
+    Individual *ind = searchIndividual(individualsRoot, userID);
+    journalIndividual(JOURNAL_INDIVIDUAL_ADD, ind);
+    shipIndividual(ind);
+    printf("User added successfully!\n");
+}
+
+void Add_Expense() {
+    int expenseID, userID, category, day, month;
+    float amount;
+    
+    while (1) {
+        printf("Enter Expense ID (1 - 1000): ");
+        scanf("%d", &expenseID);
+        
+        if (expenseID < 0 || expenseID > 1000) {
+            printf("Error: Invalid Expense ID.\n");
+            continue;
+        }
+        
+        if (searchExpense(expensesRoot, expenseID) != NULL) {
+            printf("Error: Expense ID %d already exists.\n", expenseID);
+            continue;
+        }
+        
+        break;
+    }
+    
+    while (1) {
+        printf("Enter User ID: ");
+        scanf("%d", &userID);
+        
+        if (searchIndividual(individualsRoot, userID) == NULL) {
+            printf("Error: User not found!\n");
+            continue;
+        }
+        break;
+    }
+    
+    while (1) {
+        printCategoryPrompt(NULL);
+        scanf("%d", &category);
+        
+        if (!isValidCategory(category)) {
+            printf("Error: Invalid category!\n");
+            continue;
+        }
+        break;
+    }
+    
+    printf("Enter Amount: ");
+    scanf("%f", &amount);
+    
+    while (1) {
+        printf("Enter Day (1-%d): ", DAYS_IN_MONTH);
+        scanf("%d", &day);
+        printf("Enter Month (1-%d): ", MONTHS_IN_YEAR);
+        scanf("%d", &month);
+        
+        if (!isValidDate(day, month)) {
+            printf("Error: Invalid date! Please enter a valid day and month.\n");
+            continue;
+        }
+        break;
+    }
+    
+    loadExpenseTrees();
+    Expense *exp = addExpenseRecord(expenseID, userID, category, amount, day, month);
+    
+    printf("Expense added successfully!\n");
+    if (exp != NULL && exp->flagged) {
+        printf("Note: unusually high for this user's %s spending (anomaly score %.1f).\n",
+               categoryName(category), exp->anomalyScore);
+    }
+}
+//handler is a void pointer to the expense tree that is used to traverse
+void traverseExpenseStore(void (*handler)(Expense*, void*), void* context) {
+    Expense exp;
+    for (uint32_t i = 0; i < expenseStore.header->recordCount; i++) {
+        recordToExpense(storeRecord(i), &exp);
+        handler(&exp, context);
+    }
+}
+
+void traverseExpensesWithContext(Expense* root, void (*handler)(Expense*, void*), void* context) {
+    if (root == NULL && expenseStore.cold) {
+        traverseExpenseStore(handler, context);
+        return;
+    }
+    if (frozen.active && root == expensesRoot) {
+        for (int i = 0; i < frozen.expenseCount; i++) {
+            __builtin_prefetch(frozen.expenseOrder[i + 8 < frozen.expenseCount ? i + 8 : i]);
+            handler(frozen.expenseOrder[i], context);
+        }
+        return;
+    }
+    if (root != NULL) {
+        traverseExpensesWithContext(root->left, handler, context);
+        handler(root, context);
+        traverseExpensesWithContext(root->right, handler, context);
+    }
+}
+
+// Feeds the family's expenses to handler by walking each member's expense
+// list, so family reports cost O(family expenses) instead of a full tree
+// traversal. The lists follow every insert, delete and user deletion, and
+// membership changes need nothing since members are read at call time.
+// While the store is cold there are no lists and the records are scanned;
+// handlers check membership anyway.
+void traverseFamilyExpenses(Family *family, void (*handler)(Expense*, void*), void* context) {
+    if (expensesRoot == NULL && expenseStore.cold) {
+        traverseExpenseStore(handler, context);
+        return;
+    }
+    for (int i = 0; i < family->memberCount; i++) {
+        Individual *ind = searchIndividual(individualsRoot, family->members[i]);
+        if (ind == NULL)
+            continue;
+        for (Expense *exp = ind->expenses; exp != NULL; exp = exp->nextByUser)
+            handler(exp, context);
+    }
+}
+
+// Feeds every not yet posted occurrence of the recurring rules dated within
+// [startDate, endDate] (month * 100 + day) to handler, as a temporary
+// expense with expenseID -ruleID. Nothing is added to the tree.
+void traverseRecurringWithContext(int startDate, int endDate, void (*handler)(Expense*, void*), void* context) {
+    Expense exp;
+    memset(&exp, 0, sizeof(Expense));
+    for (int i = 0; i < ruleCount; i++) {
+        RecurringRule *rule = &rules[i];
+        int first = rule->postedThrough + 1;
+        if (first < rule->startMonth)
+            first = rule->startMonth;
+        for (int month = first; month <= rule->endMonth; month++) {
+            int date = month * 100 + rule->day;
+            if (date < startDate || date > endDate)
+                continue;
+            exp.expenseID = -rule->ruleID;
+            exp.userID = rule->userID;
+            exp.category = rule->category;
+            exp.amount = rule->amount;
+            exp.day = rule->day;
+            exp.month = month;
+            handler(&exp, context);
+        }
+    }
+}
+
+// Occurrences count toward the running reports once their month has
+// started, that is through the month of the latest expense date
+int recurringDueMonth() {
+    return rollingToday / DAYS_IN_MONTH + 1;
+}
+
+void traverseDueRecurring(void (*handler)(Expense*, void*), void* context) {
+    traverseRecurringWithContext(101, recurringDueMonth() * 100 + DAYS_IN_MONTH, handler, context);
+}
+
+void familySpendCallback(Expense* exp, void* context) {
+    Family *family = (Family*)context;
+    if (isMember(family, exp->userID)) {
+        applyFamilySpend(family, exp->category, exp->amount);
+        addFamilyTrend(family, exp->category, exp->day, exp->month, exp->amount);
+    }
+}
+
+// Recomputes the family's running totals and forecast sums from scratch
+void rebuildFamilySpend(Family *family) {
+    family->totalExpense = 0.0;
+    categoryMapFree(&family->categoryExpense);
+    categoryMapFree(&family->trend);
+    memset(family->trendLastDay, 0, sizeof(family->trendLastDay));
+    memset(&family->rolling, 0, sizeof(family->rolling));
+    traverseFamilyExpenses(family, familySpendCallback, family);
+}
+
+void expenseAccumulatorCallback(Expense* exp, void* context) {
+    ExpenseAccumulator* acc = (ExpenseAccumulator*)context;
+    if (exp->userID == acc->targetUserID) {
+        acc->total += exp->amount;
+        addCategoryAmount(&acc->categoriesTotal, exp->category, exp->amount);
+    }
+}
+
+// Adds every entry of from (float values) into to
+void mergeCategoryAmounts(CategoryMap *to, const CategoryMap *from) {
+    for (int i = 0; i < from->count; i++)
+        addCategoryAmount(to, from->keys[i], *(float*)categoryMapAt(from, i, sizeof(float)));
+}
+
+void Create_Family() {
+    int familyID;
+    char familyName[50];
+    
+    while (1) {
+        printf("Enter Family ID: ");
+        scanf("%d", &familyID);
+        
+        if (familyID < 0) {
+            printf("Error: Family ID cannot be negative. Please enter a positive number.\n");
+            continue;
+        }
+        
+        if (searchFamily(familiesRoot, familyID) != NULL) {
+            printf("Error: Family ID %d already exists. Please enter a different ID.\n", familyID);
+            continue;
+        }
+        
+        break;
+    }
+    
+    printf("Enter Family Name: ");
+    scanf("%s", familyName);
+    
+    familiesRoot = insertFamily(familiesRoot, familyID, familyName);
+    Family *family = searchFamily(familiesRoot, familyID);
+    
+    int numMembers;
+    while (1) {
+        printf("Enter number of members (1-4): ");
+        scanf("%d", &numMembers);
+        
+        if (numMembers < 1 || numMembers > 4) {
+            printf("Error: Invalid number of members. Must be between 1 and 4.\n");
+            continue;
+        }
+        break;
+    }
+    
+    for (int i = 0; i < numMembers; i++) {
+        int userID;
+        
+        while (1) {
+            printf("Enter User ID for member %d: ", i+1);
+            scanf("%d", &userID);
+            
+            Individual *ind = searchIndividual(individualsRoot, userID);
+            if (ind == NULL) {
+                printf("Error: User not found. Please enter a valid user ID.\n");
+                continue;
+            }
+            
+            // Check if user is already in another family
+            Family* existingFamily = NULL;
+            searchFamilies(familiesRoot, userID, &existingFamily);
+            if (existingFamily != NULL && existingFamily != family) {
+                printf("Error: User %s (ID: %d) is already a member of family %s.\n", 
+                      nameOf(ind->userName), userID, nameOf(existingFamily->familyName));
+                continue;
+            }
+            
+            if (!addFamilyMember(family, userID)) {
+                printf("Error: User %s (ID: %d) is already a member of this family.\n", 
+                      nameOf(ind->userName), userID);
+                continue;
+            }
+            break;
+        }
+    }
+    
+    // Calculate total monthly expenses for the family
+    rebuildFamilySpend(family);
+    
+    journalFamily(JOURNAL_FAMILY_ADD, family);
+    shipFamily(family);
+    printf("\nFamily created successfully!\n");
+    printf("Family Name: %s\n", nameOf(family->familyName));
+    printf("Total Members: %d\n", numMembers);
+    printf("Total Monthly Income: %.2f\n", family->totalIncome);
+    printf("Total Monthly Expenses: %.2f\n", family->totalExpense);
+    
+    float balance = family->totalIncome - family->totalExpense;
+    if (balance >= 0) {
+        printf("Remaining Balance: %.2f\n", balance);
+    } else {
+        printf("Deficit: %.2f\n", -balance);
+    }
+}
+
+void Update_or_delete_Individual_Family_details() {
+    int choice;
+    printf("1. Update Individual\n2. Delete Individual\n3. Update Family\n4. Delete Family\nEnter choice: ");
+    scanf("%d", &choice);
+    
+    if (choice == 1) {
+        int userID;
+        printf("Enter User ID to update: ");
+        scanf("%d", &userID);
+        
+        Individual *ind = searchIndividual(individualsRoot, userID);
+    
+        if (ind == NULL) {
+            printf("User not found!\n");
+            return;
+        }
+        
+        // Display current details
+        printf("\nCurrent details:\n");
+        printf("----------------\n");
+        printf("User ID: %d\n", ind->userID);
+        printf("Name: %s\n", nameOf(ind->userName));
+        printf("Income: %.2f\n", ind->income);
+        
+        // Get updates
+        printf("\nEnter new details (enter '-' to keep current value):\n");
+        
+        printf("Name (%s): ", nameOf(ind->userName));
+        char newName[50];
+        scanf("%s", newName);
+        
+        printf("Income (%.2f): ", ind->income);
+        float newIncome;
+        scanf("%f", &newIncome);
+        
+        // Store old values for comparison
+        NameRef oldName = ind->userName;
+        float oldIncome = ind->income;
+        NameRef name = (strcmp(newName, "-") != 0) ? internName(newName) : oldName;
+        if (newIncome == -1)
+            newIncome = oldIncome;
+        
+        // Apply updates; an edit that changes nothing is not journaled
+        if (name != oldName || newIncome != oldIncome) {
+            journalIndividual(JOURNAL_INDIVIDUAL_UPDATE, ind);
+            setIndividualName(ind, name);
+            
+            // Update family incomes if this user is in any families
+            Family* family = findFamilyByUserID(userID);
+            if (family != NULL) {
+                family->totalIncome += (newIncome - ind->income);
+            }
+            ind->income = newIncome;
+            shipIndividual(ind);
+        }
+        
+        // Display updated details
+        printf("\nUpdate successful!\n");
+        printf("\nBefore update:\n");
+        printf("-------------\n");
+        printf("Name: %s\n", nameOf(oldName));
+        printf("Income: %.2f\n", oldIncome);
+        
+        printf("\nAfter update:\n");
+        printf("------------\n");
+        printf("Name: %s\n", nameOf(ind->userName));
+        printf("Income: %.2f\n", ind->income);
+    }
+    else if (choice == 2) {
+    int userID;
+    printf("Enter User ID to delete: ");
+    scanf("%d", &userID);
+    
+    Individual *ind = searchIndividual(individualsRoot, userID);
+    if (ind == NULL) {
+        printf("User not found!\n");
+        return;
+    }
+    
+  
+    // The per-user expense list only exists once the trees are loaded
+    loadExpenseTrees();
+    printf("\nUser to be deleted:\n");
+    printf("------------------\n");
+    printf("User ID: %d\n", ind->userID);
+    printf("Name: %s\n", nameOf(ind->userName));
+    printf("Income: %.2f\n", ind->income);
+    printf("Expenses: %d (will also be deleted)\n", ind->expenseCount);
+    
+    char confirm;
+    printf("\nAre you sure you want to delete this user? (y/n): ");
+    scanf(" %c", &confirm);
+    
+    if (confirm == 'y' || confirm == 'Y') {
+       
+        // Checking if this is the last member
+        Family* family = findFamilyByUserID(userID);
+        if (family != NULL && family->memberCount == 1) {
+            printf("\nThis was the last member of family %s (ID: %d).\n", 
+                  nameOf(family->familyName), family->familyID);
+            printf("The family will also be deleted.\n");
+        }
+        
+        int removed = removeIndividualRecord(ind);
+        printf("Deleted %d expense(s) of this user.\n", removed);
+        printf("User Deleted Successfully!\n");
+    } else {
+        printf("Deletion cancelled.\n");
+    }
+	}
+    else if (choice == 3) {
+        int familyID;
+        printf("Enter Family ID to update: ");
+        scanf("%d", &familyID);
+        
+        Family *fam = searchFamily(familiesRoot, familyID);
+        if (fam == NULL) {
+            printf("Family not found!\n");
+            return;
+        }
+        
+        // Display current details
+        printf("\nCurrent family details:\n");
+        printf("----------------------\n");
+        printf("Family ID: %d\n", fam->familyID);
+        printf("Name: %s\n", nameOf(fam->familyName));
+        printf("Members: %d\n", countMembers(fam));
+        printf("Total Income: %.2f\n", fam->totalIncome);
+        printf("Total Expenses: %.2f\n", fam->totalExpense);
+        
+        // Get updates
+        printf("\nEnter new details (enter '-' to keep current value):\n");
+        printf("Name (%s): ", nameOf(fam->familyName));
+        char newName[50];
+        scanf("%s", newName);
+        
+        // Store old value for comparison
+        NameRef oldName = fam->familyName;
+        
+        // Apply updates; an edit that changes nothing is not journaled
+        NameRef name = (strcmp(newName, "-") != 0) ? internName(newName) : oldName;
+        if (name != oldName) {
+            journalFamily(JOURNAL_FAMILY_UPDATE, fam);
+            setFamilyName(fam, name);
+            shipFamily(fam);
+        }
+        
+        // Display updated details
+        printf("\nUpdate successful!\n");
+        printf("\nBefore update:\n");
+        printf("-------------\n");
+        printf("Name: %s\n", nameOf(oldName));
+        
+        printf("\nAfter update:\n");
+        printf("------------\n");
+        printf("Name: %s\n", nameOf(fam->familyName));
+    }
+    else if (choice == 4) {
+    int familyID;
+    printf("Enter Family ID to delete: ");
+    scanf("%d", &familyID);
+
+    Family *fam = searchFamily(familiesRoot, familyID);
+    if (fam == NULL) {
+        printf("Family not found!\n");
+        return;
+    }
+    
+    // Display details before deletion
+    printf("\nFamily to be deleted:\n");
+    printf("--------------------\n");
+    printf("Family ID: %d\n", fam->familyID);
+    printf("Name: %s\n", nameOf(fam->familyName));
+    printf("Members: %d\n", countMembers(fam));
+    printf("Total Income: %.2f\n", fam->totalIncome);
+    printf("Total Expenses: %.2f\n", fam->totalExpense);
+    
+    char confirm;
+    printf("\nAre you sure you want to delete this family? (y/n): ");
+    scanf(" %c", &confirm);
+    
+    if (confirm == 'y' || confirm == 'Y') {
+        removeFamilyRecord(fam);
+        printf("Family Deleted.\n");
+    } else {
+        printf("Deletion cancelled.\n");
+    }
+}
+}
+
+void Update_delete_expense() {
+    int choice;
+    printf("1. Update Expense\n2. Delete Expense\nEnter choice: ");
+    scanf("%d", &choice);
+    
+    if (choice == 1) {
+        int expenseID;
+        printf("Enter Expense ID to update: ");
+        scanf("%d", &expenseID);
+        
+        Expense *exp = searchExpense(expensesRoot, expenseID);
+        if (exp == NULL) {
+            printf("Expense not found!\n");
+            return;
+        }
+        
+        printf("Current details:\n");
+        printf("User ID: %d\nCategory: %s\nAmount: %.2f\nDate: %d/%d\n", 
+               exp->userID, categoryName(exp->category), exp->amount, exp->day, exp->month);
+        
+        printCategoryPrompt("-1 to keep");
+        int newCategory;
+        scanf("%d", &newCategory);
+        if (!isValidCategory(newCategory)) {
+            newCategory = exp->category;
+        }
+        
+        printf("Enter new amount (or -1 to keep): ");
+        float newAmount;
+        scanf("%f", &newAmount);
+        if (newAmount == -1) {
+            newAmount = exp->amount;
+        }
+        
+        printf("Enter new day (1-10 or -1 to keep): ");
+        int newDay;
+        scanf("%d", &newDay);
+        if (newDay < 1 || newDay > DAYS_IN_MONTH) {
+            newDay = exp->day;
+        }
+        
+        printf("Enter new month (1-12 or -1 to keep): ");
+        int newMonth;
+        scanf("%d", &newMonth);
+        if (newMonth < 1 || newMonth > 12) {
+            newMonth = exp->month;
+        }
+        
+        // exp may be a read-only copy from the expense store until now
+        loadExpenseTrees();
+        exp = searchExpense(expensesRoot, expenseID);
+        
+        // Also updates the family total and the indexes
+        updateExpenseRecord(exp, newCategory, newAmount, newDay, newMonth);
+        printf("Expense updated successfully!\n");
+        if (exp->flagged) {
+            printf("Note: unusually high for this user's %s spending (anomaly score %.1f).\n",
+                   categoryName(exp->category), exp->anomalyScore);
+        }
+    }
+    else if (choice == 2) {
+        int expenseID;
+        printf("Enter Expense ID to delete: ");
+        scanf("%d", &expenseID);
+
+        loadExpenseTrees();
+        Expense *exp = searchExpense(expensesRoot, expenseID);
+        if (exp == NULL) {
+            printf("Expense not found!\n");
+            return;
+        }
+        
+        // Also updates the owner's list and family total
+        removeExpenseRecord(exp);
+        printf("Expense deleted!\n");
+    }
+    else {
+        printf("Invalid choice!\n");
+    }
+}
+
+
+
+// Callback function for accumulating expenses
+void individualExpenseCallback(Expense* exp, void* context) {
+    ExpenseAccumulator* acc = (ExpenseAccumulator*)context;
+    if (exp->userID == acc->targetUserID) {
+        acc->total += exp->amount;
+        addCategoryAmount(&acc->categoriesTotal, exp->category, exp->amount);
+    }
+}
+
+typedef struct {
+    int category;
+    float amount;
+} CategoryAmount;
+
+int compareCategoryAmounts(const void *a, const void *b) {
+    float x = ((const CategoryAmount*)a)->amount;
+    float y = ((const CategoryAmount*)b)->amount;
+    return (x < y) - (x > y);   // descending
+}
+
+void Get_individual_expense() {
+    int userID;
+    printf("Enter User ID: ");
+    scanf("%d", &userID);
+    
+    Individual *ind = searchIndividual(individualsRoot, userID);
+    if (ind == NULL) {
+        printf("User not found!\n");
+        return;
+    }
+    
+    ExpenseAccumulator acc = {
+        .targetUserID = userID,
+        .total = 0
+    };
+    
+    // Traverse expenses with context
+    traverseExpensesWithContext(expensesRoot, individualExpenseCallback, &acc);
+    
+    // Recurring expenses that are due but not posted yet count as well
+    ExpenseAccumulator scheduled = {
+        .targetUserID = userID,
+        .total = 0
+    };
+    traverseDueRecurring(individualExpenseCallback, &scheduled);
+    acc.total += scheduled.total;
+    mergeCategoryAmounts(&acc.categoriesTotal, &scheduled.categoriesTotal);
+    categoryMapFree(&scheduled.categoriesTotal);
+    
+    // Display results
+    printf("\nExpense Report for %s (ID: %d)\n", nameOf(ind->userName), userID);
+    printf("--------------------------------\n");
+    printf("Total Monthly Expense: %.2f\n", acc.total);
+    if (scheduled.total > 0)
+        printf("(includes %.2f in recurring expenses due through month %d, not yet posted)\n",
+               scheduled.total, recurringDueMonth());
+    printf("\n");
+    
+    // Sort the categories the user spent in by amount (descending)
+    int used = acc.categoriesTotal.count;
+    CategoryAmount *sorted = (CategoryAmount*)malloc(sizeof(CategoryAmount) * (used + 1));
+    for (int i = 0; i < used; i++) {
+        sorted[i].category = acc.categoriesTotal.keys[i];
+        sorted[i].amount = *(float*)categoryMapAt(&acc.categoriesTotal, i, sizeof(float));
+    }
+    qsort(sorted, used, sizeof(CategoryAmount), compareCategoryAmounts);
+    
+    // Print breakdown
+    printf("Category Breakdown:\n");
+    printf("-------------------\n");
+    for(int i=0; i<used; i++) {
+        if(sorted[i].amount > 0) {
+            printf("%-10s: %.2f (%.1f%%)\n", 
+                  categoryName(sorted[i].category), 
+                  sorted[i].amount,
+                  (sorted[i].amount/acc.total)*100);
+        }
+    }
+    printf("\n");
+    free(sorted);
+    categoryMapFree(&acc.categoriesTotal);
+}
+
+void printPeriodRow(Expense* exp) {
+    Individual* ind = searchIndividual(individualsRoot, exp->userID);
+    if (exp->expenseID < 0) {
+        // Occurrence of a recurring rule, see traverseRecurringWithContext
+        printf("Rule: R%-4d Date: %2d/%-2d %-10s %-5s %7.2f (User: %s)\n",
+               -exp->expenseID, exp->day, exp->month, categoryName(exp->category), "",
+               exp->amount, ind ? nameOf(ind->userName) : "Unknown");
+        return;
+    }
+    printf("ID: %-5d Date: %2d/%-2d %-10s %-9s %7.2f (User: %s)\n",
+           exp->expenseID,
+           exp->day, exp->month,
+           categoryName(exp->category),
+           "", // Padding
+           exp->amount,
+           ind ? nameOf(ind->userName) : "Unknown");
+}
+
+void dateRangeCallback(Expense* exp, void* context) {
+    DateRangeFilter* filter = (DateRangeFilter*)context;
+    
+    // Check if expense is within date range
+    if ((exp->month > filter->startMonth || 
+         (exp->month == filter->startMonth && exp->day >= filter->startDay)) &&
+        (exp->month < filter->endMonth || 
+         (exp->month == filter->endMonth && exp->day <= filter->endDay))) {
+        
+        printPeriodRow(exp);
+        filter->hasResults = true;
+    }
+}
+
+void recurringCountCallback(Expense* exp, void* context) {
+    (void)exp;
+    (*(int*)context)++;
+}
+
+void recurringRowCallback(Expense* exp, void* context) {
+    printPeriodRow(exp);
+    *(float*)context += exp->amount;
+}
+
+void printRecurringInPeriod(int startDate, int endDate) {
+    int count = 0;
+    traverseRecurringWithContext(startDate, endDate, recurringCountCallback, &count);
+    if (count == 0)
+        return;
+    float total = 0;
+    printf("\nRecurring expenses not yet posted:\n");
+    traverseRecurringWithContext(startDate, endDate, recurringRowCallback, &total);
+    printf("Recurring total: %.2f\n", total);
+}
+
+// Prompts for page size and a continuation token, then prints header and
+// the query one page at a time. Returns false when the user chose to list
+// everything at once (page size 0), leaving that to the caller. Otherwise
+// *shown and *total cover the rows printed.
+bool pageListing(const ExpenseQuery *q, const char *header, void (*printRow)(Expense*), int *shown, float *total) {
+    int pageSize;
+    long token;
+    printf("Enter page size (0 for all): ");
+    scanf("%d", &pageSize);
+    if (pageSize <= 0)
+        return false;
+    printf("Enter continuation token (-1 to start from the beginning): ");
+    scanf("%ld", &token);
+
+    printf("%s", header);
+    printf("------------------------------------------------\n");
+
+    Expense **rows = (Expense**)malloc(sizeof(Expense*) * pageSize);
+    *shown = 0;
+    *total = 0.0;
+
+    while (1) {
+        int n = fetchExpensePage(q, token, rows, pageSize, &token);
+        for (int i = 0; i < n; i++) {
+            printRow(rows[i]);
+            *total += rows[i]->amount;
+        }
+        *shown += n;
+
+        if (token < 0)
+            break;
+        char more;
+        printf("-- Continuation token: %ld -- Next page? (y/n): ", token);
+        scanf(" %c", &more);
+        if (more != 'y' && more != 'Y')
+            break;
+    }
+
+    free(rows);
+    return true;
+}
+
+void Get_expense_in_period() {
+    int day1, month1, day2, month2;
+    printf("Enter start date (day month): ");
+    scanf("%d %d", &day1, &month1);
+    printf("Enter end date (day month): ");
+    scanf("%d %d", &day2, &month2);
+    
+    if (month1 < 1 || month1 > 12 || month2 < 1 || month2 > 12 ||
+        day1 < 1 || day1 > DAYS_IN_MONTH || day2 < 1 || day2 > DAYS_IN_MONTH) {
+        printf("Invalid date!\n");
+        return;
+    }
+    
+    ExpenseQuery q;
+    initExpenseQuery(&q);
+    q.startDate = month1 * 100 + day1;
+    q.endDate = month2 * 100 + day2;
+    
+    char header[128];
+    snprintf(header, sizeof(header), "\nExpenses between %d/%d/25 and %d/%d/25:\n", day1, month1, day2, month2);
+    
+    int shown;
+    float pageTotal;
+    bool paged = pageListing(&q, header, printPeriodRow, &shown, &pageTotal);
+    if (paged) {
+        if (shown == 0) {
+            printf("No expenses found in this period.\n");
+        }
+        printRecurringInPeriod(q.startDate, q.endDate);
+        printf("\n");
+        return;
+    }
+    
+    printf("%s", header);
+    printf("------------------------------------------------\n");
+    
+    //a struct that records the range limits
+    //this struuct is passed to the traverse function where 
+    //each node is compared with this filter and then printed
+    
+    DateRangeFilter filter = {
+        .startDay = day1,
+        .startMonth = month1,
+        .endDay = day2,
+        .endMonth = month2,
+        .hasResults = false
+    };
+    
+    traverseExpensesWithContext(expensesRoot, dateRangeCallback, &filter);
+    
+    if (!filter.hasResults) {
+        printf("No expenses found in this period.\n");
+    }
+    printRecurringInPeriod(q.startDate, q.endDate);
+    printf("\n");
+}
+
+
+
+// Recurring expenses that are due but not posted yet are reported but not
+// added to the family's running total
+float familyScheduledSpend(Family *family) {
+    float scheduled = 0.0;
+    for (int i = 0; i < family->memberCount; i++) {
+        ExpenseAccumulator acc = {
+            .targetUserID = family->members[i],
+            .total = 0
+        };
+        traverseDueRecurring(expenseAccumulatorCallback, &acc);
+        scheduled += acc.total;
+        categoryMapFree(&acc.categoriesTotal);
+    }
+    return scheduled;
+}
+
+void Get_total_expense() {
+    int familyID;
+    printf("Enter Family ID: ");
+    scanf("%d", &familyID);
+    
+    Family *family = searchFamily(familiesRoot, familyID);
+    if (family == NULL) {
+        printf("Family not found!\n");
+        return;
+    }
+    
+    // totalExpense is kept current by every expense change
+    float scheduled = familyScheduledSpend(family);
+    float totalExpense = family->totalExpense + scheduled;
+    
+    printf("\nFamily: %s (ID: %d)\n", nameOf(family->familyName), family->familyID);
+    printf("--------------------------------\n");
+    printf("Total Monthly Income:    %.2f\n", family->totalIncome);
+    printf("Total Monthly Expenses:  %.2f\n", totalExpense);
+    if (scheduled > 0)
+        printf("(includes %.2f in recurring expenses due through month %d, not yet posted)\n",
+               scheduled, recurringDueMonth());
+    
+    float balance = family->totalIncome - totalExpense;
+    
+    printf("\nExpense Analysis:\n");
+    printf("-----------------\n");
+    if (balance >= 0) {
+        printf("The family's expenses (%.2f) are WITHIN their income (%.2f).\n", 
+              totalExpense, family->totalIncome);
+        printf("Remaining Balance: %.2f\n", balance);
+    } else {
+        printf("WARNING: The family's expenses (%.2f) SURPASS their income (%.2f).\n", 
+              totalExpense, family->totalIncome);
+        printf("Deficit: %.2f\n", -balance);
+    }
+    
+    // Calculate percentage of income spent
+    if (family->totalIncome > 0) {
+        float percentage = (totalExpense / family->totalIncome) * 100;
+        printf("\nExpense-to-Income Ratio: %.1f%%\n", percentage);
         
-        if (searchIndividual(individualsRoot, userID) == NULL) {
-            printf("Error: User not found!\n");
+        if (percentage > 100) {
+            printf("The family is spending %.1f%% MORE than their income!\n", percentage - 100);
+        } else if (percentage == 100) {
+            printf("The family is spending exactly 100%% of their income.\n");
+        } else {
+            printf("The family is spending %.1f%% of their income.\n", percentage);
+        }
+    } else {
+        printf("\nNote: Family has no income (income = 0).\n");
+    }
+    printf("\n");
+}
+typedef enum {
+    REPORT_NONE,
+    REPORT_CATEGORICAL,
+    REPORT_HIGHEST_DAY
+} ReportKind;
+
+// One report result for a family, valid while the family's generation and
+// the recurring due month are the ones it was computed at. Member names are
+// looked up when printed.
+typedef struct {
+    uint8_t kind;           // ReportKind
+    int familyID;
+    int param;              // category of a categorical report
+    uint32_t generation;
+    int dueMonth;
+    union {
+        struct {
+            Contribution contributions[MAX_FAMILY_MEMBERS];    // largest first
+            int memberCount;
+            float total;
+        } categorical;
+        struct {
+            int day, month;
+            float amount;
+        } highestDay;
+    } result;
+} ReportCacheEntry;
+
+// Direct mapped: a colliding query just replaces the older result
+ReportCacheEntry reportCache[REPORT_CACHE_SLOTS];
+
+// The slot for a query; *hit says whether it already holds a current result
+ReportCacheEntry* reportCacheSlot(ReportKind kind, Family *family, int param, bool *hit) {
+    uint32_t hash = ((uint32_t)family->familyID * 2654435761u) ^ ((uint32_t)param * 40503u) ^ kind;
+    ReportCacheEntry *entry = &reportCache[(hash ^ (hash >> 16)) & (REPORT_CACHE_SLOTS - 1)];
+    *hit = entry->kind == kind && entry->familyID == family->familyID &&
+           entry->param == param && entry->generation == family->generation &&
+           entry->dueMonth == recurringDueMonth();
+    if (!*hit) {
+        entry->dueMonth = recurringDueMonth();
+        entry->kind = kind;
+        entry->familyID = family->familyID;
+        entry->param = param;
+        entry->generation = family->generation;
+    }
+    return entry;
+}
+
+void categoricalCallback(Expense *exp, void *context) {
+    CategoryContext *ctx = (CategoryContext *)context;
+    if (categoryWithin(exp->category, ctx->category)) {
+        for (int i = 0; i < ctx->memberCount; i++) {
+            if (exp->userID == ctx->contributions[i].userID) {
+                ctx->contributions[i].amount += exp->amount;
+                *(ctx->total) += exp->amount;
+                break;
+            }
+        }
+    }
+}
+
+
+
+ 
+// Fills contributions with each member's spend in category (subcategories
+// included), largest first, and returns how many there are
+int familyCategoryContributions(Family *family, int category, Contribution *contributions, float *total) {
+    int memberCount = 0;
+    *total = 0.0;
+
+    // Initialize contributions array
+    for (int i = 0; i < family->memberCount; i++) {
+        Individual *ind = searchIndividual(individualsRoot, family->members[i]);
+        if (ind) {
+            contributions[memberCount].userID = ind->userID;
+            contributions[memberCount].name = ind->userName;
+            contributions[memberCount].amount = 0.0;
+            memberCount++;
+        }
+    }
+
+    // Create and populate context
+    CategoryContext context;
+    context.category = category;
+    context.contributions = contributions;
+    context.memberCount = memberCount;
+    context.total = total;
+
+    // Traverse expenses with context
+    traverseFamilyExpenses(family, categoricalCallback, &context);
+    traverseDueRecurring(categoricalCallback, &context);
+
+    // Sort contributions (bubble sort)
+    for (int i = 0; i < memberCount-1; i++) {
+        for (int j = 0; j < memberCount-i-1; j++) {
+            if (contributions[j].amount < contributions[j+1].amount) {
+                Contribution temp = contributions[j];
+                contributions[j] = contributions[j+1];
+                contributions[j+1] = temp;
+            }
+        }
+    }
+    return memberCount;
+}
+
+void Get_categorical_expense() {
+    int familyID, category;
+    printf("Enter Family ID: ");
+    scanf("%d", &familyID);
+    printCategoryPrompt(NULL);
+    scanf("%d", &category);
+    
+    if (!isValidCategory(category)) {
+        printf("Invalid category!\n");
+        return;
+    }
+    
+    Family *family = searchFamily(familiesRoot, familyID);
+    if (family == NULL) {
+        printf("Family not found!\n");
+        return;
+    }
+
+    bool hit;
+    ReportCacheEntry *entry = reportCacheSlot(REPORT_CATEGORICAL, family, category, &hit);
+    Contribution *contributions = entry->result.categorical.contributions;
+    if (!hit)
+        entry->result.categorical.memberCount = familyCategoryContributions(
+            family, category, contributions, &entry->result.categorical.total);
+
+    // Display results
+    printf("\n%s Expenses for Family %s\n", categoryName(category), nameOf(family->familyName));
+    printf("Total: %.2f\n", entry->result.categorical.total);
+    printf("Individual Contributions:\n");
+    
+    for (int i = 0; i < entry->result.categorical.memberCount; i++) {
+        Individual *ind = searchIndividual(individualsRoot, contributions[i].userID);
+        if (contributions[i].amount > 0 && ind != NULL) {
+            printf("- %s (ID: %d): %.2f\n", 
+                   nameOf(ind->userName), 
+                   contributions[i].userID,
+                   contributions[i].amount);
+        }
+    }
+    printf("\n");
+}
+
+void dailyExpenseCallback(Expense* exp, void* context) {
+    DailyExpenseTracker* tracker = (DailyExpenseTracker*)context;
+    if (isMember(tracker->family, exp->userID)) {
+        if (exp->month >= 1 && exp->month <= 12 &&
+            exp->day >= 1 && exp->day <= DAYS_IN_MONTH) {
+            tracker->dailyExpenses[exp->month-1][exp->day-1] += exp->amount;
+        }
+    }
+}
+
+// Returns the largest daily total and its date; 0 (and 1/1) if none is positive
+float highestExpenseDay(float dailyExpenses[MONTHS_IN_YEAR][DAYS_IN_MONTH], int *maxDay, int *maxMonth) {
+    float maxExpense = 0;
+    *maxDay = 1;
+    *maxMonth = 1;
+    for (int m = 0; m < MONTHS_IN_YEAR; m++) {
+        for (int d = 0; d < DAYS_IN_MONTH; d++) {
+            if (dailyExpenses[m][d] > maxExpense) {
+                maxExpense = dailyExpenses[m][d];
+                *maxDay = d + 1;
+                *maxMonth = m + 1;
+            }
+        }
+    }
+    return maxExpense;
+}
+
+float familyHighestDay(Family *family, int *maxDay, int *maxMonth) {
+    //struct to keep a track 
+    //put this constraint wala struct in traverse() 
+    DailyExpenseTracker tracker = {
+        .family = family,
+        .dailyExpenses = {{0}}
+    };
+
+    traverseFamilyExpenses(family, dailyExpenseCallback, &tracker);
+    traverseDueRecurring(dailyExpenseCallback, &tracker);
+    return highestExpenseDay(tracker.dailyExpenses, maxDay, maxMonth);
+}
+
+void Get_highest_expense_day() {
+    int familyID;
+    printf("Enter Family ID: ");
+    scanf("%d", &familyID);
+    
+    Family *family = searchFamily(familiesRoot, familyID);
+    if (family == NULL) {
+        printf("Family not found!\n");
+        return;
+    }
+    bool hit;
+    ReportCacheEntry *entry = reportCacheSlot(REPORT_HIGHEST_DAY, family, 0, &hit);
+    if (!hit)
+        entry->result.highestDay.amount = familyHighestDay(family, &entry->result.highestDay.day,
+                                                           &entry->result.highestDay.month);
+    
+    if (entry->result.highestDay.amount > 0) {
+        printf("Highest expense day for family %s: %d/%d/25 with total expense: %.2f\n", 
+              nameOf(family->familyName), entry->result.highestDay.day,
+              entry->result.highestDay.month, entry->result.highestDay.amount);
+    } else {
+        printf("No expenses found for this family.\n");
+    }
+}
+
+// Runs the statements after exp with exp bound to every expense of family
+// and member to its owner's position in family->members. Warm, it walks the
+// members' expense lists as traverseFamilyExpenses does; cold, it scans the
+// mapped records. The statements are expanded in place, so a scan that
+// feeds several aggregations makes no indirect call per expense.
+#define FOR_EACH_FAMILY_EXPENSE(family, member, exp, ...) do {                  \
+    if (expensesRoot == NULL && expenseStore.cold) {                            \
+        Expense exp##Copy;                                                      \
+        for (uint32_t exp##Row = 0; exp##Row < expenseStore.header->recordCount; exp##Row++) { \
+            recordToExpense(storeRecord(exp##Row), &exp##Copy);                 \
+            Expense *exp = &exp##Copy;                                          \
+            int member = familyMemberIndex(family, exp->userID);                \
+            if (member >= 0) {                                                  \
+                __VA_ARGS__                                                     \
+            }                                                                   \
+        }                                                                       \
+    } else {                                                                    \
+        for (int member = 0; member < (family)->memberCount; member++) {        \
+            Individual *exp##Owner = searchIndividual(individualsRoot, (family)->members[member]); \
+            for (Expense *exp = exp##Owner ? exp##Owner->expenses : NULL; exp != NULL; exp = exp->nextByUser) { \
+                __VA_ARGS__                                                     \
+            }                                                                   \
+        }                                                                       \
+    }                                                                           \
+} while (0)
+
+// Everything the morning summary reports about one family
+typedef struct {
+    Family *family;
+    float total;
+    float scheduled;                            // recurring, due and not posted yet
+    float memberTotals[MAX_FAMILY_MEMBERS];     // by position in family->members
+    CategoryMap categoryTotals;                 // float by category, rolled up
+    CategoryMap contributions;                  // float by category * MAX_FAMILY_MEMBERS + member
+    float dailyExpenses[MONTHS_IN_YEAR][DAYS_IN_MONTH];
+    long scanned;
+} FamilySummary;
+
+// The summary's aggregations. Each folds one member expense into its part
+// of the summary; SUMMARY_AGGREGATES registers them for the fused scan.
+static inline void summarizeTotals(FamilySummary *s, int member, const Expense *exp) {
+    s->total += exp->amount;
+    s->memberTotals[member] += exp->amount;
+}
+
+static inline void summarizeCategories(FamilySummary *s, int member, const Expense *exp) {
+    for (int c = exp->category; isValidCategory(c); c = categoryTable[c].parent) {
+        addCategoryAmount(&s->categoryTotals, c, exp->amount);
+        addCategoryAmount(&s->contributions, c * MAX_FAMILY_MEMBERS + member, exp->amount);
+    }
+}
+
+static inline void summarizeDays(FamilySummary *s, int member, const Expense *exp) {
+    (void)member;
+    if (exp->month >= 1 && exp->month <= MONTHS_IN_YEAR && exp->day >= 1 && exp->day <= DAYS_IN_MONTH)
+        s->dailyExpenses[exp->month - 1][exp->day - 1] += exp->amount;
+}
+
+#define SUMMARY_AGGREGATES(s, member, exp)  \
+    summarizeTotals(s, member, exp);        \
+    summarizeCategories(s, member, exp);    \
+    summarizeDays(s, member, exp);
+
+int familyMemberIndex(Family *family, int userID) {
+    if (!isMember(family, userID))
+        return -1;
+    for (int i = 0; i < family->memberCount; i++) {
+        if (family->members[i] == userID)
+            return i;
+    }
+    return -1;
+}
+
+void summaryRecurringCallback(Expense *exp, void *context) {
+    FamilySummary *s = (FamilySummary*)context;
+    int member = familyMemberIndex(s->family, exp->userID);
+    if (member < 0)
+        return;
+    s->scheduled += exp->amount;
+    SUMMARY_AGGREGATES(s, member, exp)
+}
+
+// One pass over the family's expenses for all of the summary's
+// aggregations, where the separate reports take one each. Free with
+// freeFamilySummary.
+void summarizeFamily(Family *family, FamilySummary *s) {
+    memset(s, 0, sizeof(FamilySummary));
+    s->family = family;
+    FOR_EACH_FAMILY_EXPENSE(family, member, exp,
+        s->scanned++;
+        SUMMARY_AGGREGATES(s, member, exp)
+    );
+    traverseDueRecurring(summaryRecurringCallback, s);
+}
+
+void freeFamilySummary(FamilySummary *s) {
+    categoryMapFree(&s->categoryTotals);
+    categoryMapFree(&s->contributions);
+}
+
+void printFamilySummary(FamilySummary *s) {
+    Family *family = s->family;
+    printf("\nMorning summary for family %s (ID: %d)\n", nameOf(family->familyName), family->familyID);
+    printf("------------------------------------------------\n");
+    printf("Total Monthly Income:    %.2f\n", family->totalIncome);
+    printf("Total Monthly Expenses:  %.2f\n", s->total);
+    if (s->scheduled > 0)
+        printf("(includes %.2f in recurring expenses due through month %d, not yet posted)\n",
+               s->scheduled, recurringDueMonth());
+    float balance = family->totalIncome - s->total;
+    if (balance >= 0)
+        printf("Remaining Balance:       %.2f\n", balance);
+    else
+        printf("Deficit:                 %.2f\n", -balance);
+
+    printf("\nBy member:\n");
+    for (int i = 0; i < family->memberCount; i++) {
+        Individual *ind = searchIndividual(individualsRoot, family->members[i]);
+        printf("  %-16s %10.2f\n", ind ? nameOf(ind->userName) : "Unknown", s->memberTotals[i]);
+    }
+
+    printf("\nBy category (subcategories included):\n");
+    for (int i = 0; i < s->categoryTotals.count; i++) {
+        int c = s->categoryTotals.keys[i];
+        float amount = *(float*)categoryMapAt(&s->categoryTotals, i, sizeof(float));
+        if (amount == 0)
             continue;
+        printf("  %-16s %10.2f  ", categoryName(c), amount);
+        for (int m = 0; m < family->memberCount; m++) {
+            float part = categoryAmount(&s->contributions, c * MAX_FAMILY_MEMBERS + m);
+            Individual *ind = searchIndividual(individualsRoot, family->members[m]);
+            if (part > 0)
+                printf(" %s %.2f", ind ? nameOf(ind->userName) : "Unknown", part);
+        }
+        printf("\n");
+    }
+
+    int maxDay, maxMonth;
+    float maxExpense = highestExpenseDay(s->dailyExpenses, &maxDay, &maxMonth);
+    if (maxExpense > 0)
+        printf("\nHighest expense day: %d/%d/25 with total expense: %.2f\n", maxDay, maxMonth, maxExpense);
+    else
+        printf("\nNo expenses found for this family.\n");
+}
+
+// What the summary costs when built from the separate reports, with their
+// result caches bypassed: Get_total_expense reads the running totals, then
+// one Get_categorical_expense per category the family spent in and one
+// Get_highest_expense_day. Returns the number of expense scans.
+int summarizeSeparately(Family *family) {
+    familyScheduledSpend(family);
+    int scans = 0;
+    for (int i = 0; i < family->categoryExpense.count; i++) {
+        Contribution contributions[MAX_FAMILY_MEMBERS];
+        float total;
+        familyCategoryContributions(family, family->categoryExpense.keys[i], contributions, &total);
+        scans++;
+    }
+    int day, month;
+    familyHighestDay(family, &day, &month);
+    return scans + 1;
+}
+
+void Family_summary() {
+    int choice, familyID;
+    printf("1. Morning Summary\n2. Benchmark Against Separate Reports\nEnter choice: ");
+    scanf("%d", &choice);
+    printf("Enter Family ID: ");
+    scanf("%d", &familyID);
+    Family *family = searchFamily(familiesRoot, familyID);
+    if (family == NULL) {
+        printf("Family not found!\n");
+        return;
+    }
+
+    if (choice == 1) {
+        FamilySummary summary;
+        double start = nowMs();
+        summarizeFamily(family, &summary);
+        double elapsed = nowMs() - start;
+        printFamilySummary(&summary);
+        printf("%ld family expense(s) aggregated in one pass, %.3f ms\n", summary.scanned, elapsed);
+        freeFamilySummary(&summary);
+    }
+    else if (choice == 2) {
+        int rounds;
+        printf("Rounds: ");
+        scanf("%d", &rounds);
+        if (rounds < 1)
+            rounds = 1;
+        int scans = 0;
+        double start = nowMs();
+        for (int r = 0; r < rounds; r++)
+            scans = summarizeSeparately(family);
+        double separateMs = (nowMs() - start) / rounds;
+
+        start = nowMs();
+        for (int r = 0; r < rounds; r++) {
+            FamilySummary summary;
+            summarizeFamily(family, &summary);
+            freeFamilySummary(&summary);
+        }
+        double fusedMs = (nowMs() - start) / rounds;
+        printf("\nSeparate reports: %d scans, %.3f ms per summary\n", scans, separateMs);
+        printf("Fused scan:       1 scan,  %.3f ms per summary\n", fusedMs);
+    }
+    else {
+        printf("Invalid choice!\n");
+    }
+    printf("\n");
+}
+
+void flattenIndividuals(Individual* root, Individual** out, int* n) {
+    if (root == NULL) return;
+    flattenIndividuals(root->left, out, n);
+    out[(*n)++] = root;
+    flattenIndividuals(root->right, out, n);
+}
+
+// rank[k] = in-order rank of Eytzinger position k, for positions 1..n
+void eytzingerRanks(int *rank, int n, int k, int *next) {
+    if (k > n) return;
+    eytzingerRanks(rank, n, 2 * k, next);
+    rank[k] = (*next)++;
+    eytzingerRanks(rank, n, 2 * k + 1, next);
+}
+
+// Lays the expense and individual keys out in contiguous Eytzinger arrays
+// for the read-only part of the day. The nodes themselves stay where they
+// are, since the user lists, the amount index and the versions point at
+// them; lookups touch only the key array until the final hit.
+void freezeTrees() {
+    loadExpenseTrees();
+    thawTrees();
+
+    int n = countExpense(expensesRoot);
+    int *rank = (int*)malloc(sizeof(int) * (n > MAX_USERS ? n + 1 : MAX_USERS + 2));
+    frozen.expenseOrder = (Expense**)malloc(sizeof(Expense*) * (n + 1));
+    frozen.expenseKeys = (int*)malloc(sizeof(int) * (n + 1));
+    frozen.expenseNodes = (Expense**)malloc(sizeof(Expense*) * (n + 1));
+    flattenExpenses(expensesRoot, frozen.expenseOrder, &frozen.expenseCount);
+    int next = 0;
+    eytzingerRanks(rank, n, 1, &next);
+    for (int k = 1; k <= n; k++) {
+        frozen.expenseNodes[k] = frozen.expenseOrder[rank[k]];
+        frozen.expenseKeys[k] = frozen.expenseNodes[k]->expenseID;
+    }
+
+    Individual **users = (Individual**)malloc(sizeof(Individual*) * (MAX_USERS + 1));
+    flattenIndividuals(individualsRoot, users, &frozen.userCount);
+    int m = frozen.userCount;
+    frozen.userKeys = (int*)malloc(sizeof(int) * (m + 1));
+    frozen.userNodes = (Individual**)malloc(sizeof(Individual*) * (m + 1));
+    next = 0;
+    eytzingerRanks(rank, m, 1, &next);
+    for (int k = 1; k <= m; k++) {
+        frozen.userNodes[k] = users[rank[k]];
+        frozen.userKeys[k] = users[rank[k]]->userID;
+    }
+    free(users);
+    free(rank);
+    frozen.active = true;
+}
+
+void sumAmountCallback(Expense* exp, void* context) {
+    *(double*)context += exp->amount;
+}
+
+// Times the same random lookups and a full scan on the live trees (with
+// the frozen arrays switched off) and on the frozen layout
+void benchmarkFrozenTrees(int lookups) {
+    if (!frozen.active) {
+        printf("Freezing for the benchmark.\n");
+        freezeTrees();
+    }
+    if (frozen.expenseCount == 0) {
+        printf("No expenses to benchmark.\n");
+        return;
+    }
+    int lo = frozen.expenseOrder[0]->expenseID;
+    int span = frozen.expenseOrder[frozen.expenseCount - 1]->expenseID - lo + 1;
+    int *ids = (int*)malloc(sizeof(int) * lookups);
+    srand(12345);
+    for (int i = 0; i < lookups; i++)
+        ids[i] = lo + (int)(((long long)rand() * RAND_MAX + rand()) % span);
+
+    double ms[2][3];
+    long hits[2] = {0, 0};
+    double sums[2] = {0, 0};
+    for (int layout = 0; layout < 2; layout++) {
+        frozen.active = (layout == 1);
+        double start = nowMs();
+        for (int i = 0; i < lookups; i++)
+            hits[layout] += searchExpense(expensesRoot, ids[i]) != NULL;
+        ms[layout][0] = nowMs() - start;
+
+        start = nowMs();
+        for (int i = 0; i < lookups; i++)
+            hits[layout] += searchIndividual(individualsRoot, ids[i] % (MAX_USERS + 1)) != NULL;
+        ms[layout][1] = nowMs() - start;
+
+        start = nowMs();
+        traverseExpensesWithContext(expensesRoot, sumAmountCallback, &sums[layout]);
+        ms[layout][2] = nowMs() - start;
+    }
+    frozen.active = true;
+    free(ids);
+
+    printf("\n%-22s %12s %12s\n", "", "Live trees", "Frozen");
+    printf("%-22s %9.3f ms %9.3f ms\n", "Expense lookups", ms[0][0], ms[1][0]);
+    printf("%-22s %9.3f ms %9.3f ms\n", "User lookups", ms[0][1], ms[1][1]);
+    printf("%-22s %9.3f ms %9.3f ms\n", "Full expense scan", ms[0][2], ms[1][2]);
+    printf("%d lookups of each kind over %d expenses and %d users%s\n", lookups,
+           frozen.expenseCount, frozen.userCount,
+           (hits[0] == hits[1] && sums[0] == sums[1]) ? "" : " (RESULTS DIFFER)");
+}
+
+void Freeze_trees() {
+    int choice;
+    if (frozen.active)
+        printf("Trees are frozen (%d expenses, %d users).\n", frozen.expenseCount, frozen.userCount);
+    else
+        printf("Trees are live.\n");
+    printf("1. Freeze For Read-Only Use\n2. Thaw\n3. Benchmark Lookups and Scans\nEnter choice: ");
+    scanf("%d", &choice);
+
+    if (choice == 1) {
+        double start = nowMs();
+        freezeTrees();
+        printf("Froze %d expenses and %d users in %.3f ms. The next write thaws them.\n",
+               frozen.expenseCount, frozen.userCount, nowMs() - start);
+    }
+    else if (choice == 2) {
+        thawTrees();
+        printf("Trees thawed.\n");
+    }
+    else if (choice == 3) {
+        int lookups;
+        printf("Number of lookups: ");
+        scanf("%d", &lookups);
+        if (lookups < 1)
+            lookups = 1;
+        benchmarkFrozenTrees(lookups);
+    }
+    else {
+        printf("Invalid choice!\n");
+    }
+    printf("\n");
+}
+
+void printWindow(const char *label, RollingWindow *w) {
+    advanceWindow(w, rollingToday);
+    printf("%-20s %13.2f %13.2f\n", label, w->weekTotal, w->total);
+}
+
+void Rolling_spend() {
+    int choice;
+    // User windows and category windows are filled as the trees are built
+    loadExpenseTrees();
+    printf("1. User\n2. Family\n3. All Users by Category\nEnter choice: ");
+    scanf("%d", &choice);
+
+    char header[128];
+    snprintf(header, sizeof(header), "\nAs of %d/%d:\n%-20s %13s %13s\n",
+             rollingToday % DAYS_IN_MONTH + 1, rollingToday / DAYS_IN_MONTH + 1,
+             "", "Last 7 days", "Last 30 days");
+    if (choice == 1) {
+        int userID;
+        printf("Enter User ID: ");
+        scanf("%d", &userID);
+        Individual *ind = searchIndividual(individualsRoot, userID);
+        if (ind == NULL) {
+            printf("User not found!\n");
+            return;
+        }
+        printf("%s", header);
+        printWindow(nameOf(ind->userName), &ind->rolling);
+    }
+    else if (choice == 2) {
+        int familyID;
+        printf("Enter Family ID: ");
+        scanf("%d", &familyID);
+        Family *family = searchFamily(familiesRoot, familyID);
+        if (family == NULL) {
+            printf("Family not found!\n");
+            return;
+        }
+        printf("%s", header);
+        printWindow(nameOf(family->familyName), &family->rolling);
+        for (int i = 0; i < family->memberCount; i++) {
+            Individual *ind = searchIndividual(individualsRoot, family->members[i]);
+            if (ind != NULL) {
+                char label[40];
+                snprintf(label, sizeof(label), "  %s", nameOf(ind->userName));
+                printWindow(label, &ind->rolling);
+            }
+        }
+    }
+    else if (choice == 3) {
+        printf("%s", header);
+        for (int c = 0; c < categoryCount; c++) {
+            char label[40];
+            snprintf(label, sizeof(label), "%*s%s", 2 * categoryTable[c].depth, "", categoryName(c));
+            printWindow(label, &categoryRolling[c]);
         }
-        break;
     }
+    else {
+        printf("Invalid choice!\n");
+    }
+    printf("\n");
+}
+
+//checks each node with the range
+//basically compares
+void printRangeRow(Expense* exp) {
+    printf("ID: %-5d Date: %2d/%-2d %-10s %7.2f\n",
+           exp->expenseID,
+           exp->day, exp->month,
+           categoryName(exp->category),
+           exp->amount);
+}
+
+void idRangeCallback(Expense* exp, void* context) {
+    IDRangeFilter* filter = (IDRangeFilter*)context;
     
-    while (1) {
-        printf("Enter Category (0-Rent, 1-Utility, 2-Grocery, 3-Stationary, 4-Leisure): ");
-        scanf("%d", &category);
+    if (exp->userID == filter->userID && 
+        exp->expenseID >= filter->startID && 
+        exp->expenseID <= filter->endID) {
         
-        if (category < 0 || category >= CATEGORIES) {
-            printf("Error: Invalid category!\n");
-            continue;
-        }
-        break;
+        printRangeRow(exp);
+        filter->hasResults = true;
+        filter->total += exp->amount;
+    }
+}
+
+
+void Get_expense_in_range() {
+    int userID, expID1, expID2;
+    printf("Enter User ID: ");
+    scanf("%d", &userID);
+    printf("Enter start Expense ID: ");
+    scanf("%d", &expID1);
+    printf("Enter end Expense ID: ");
+    scanf("%d", &expID2);
+    
+    Individual *ind = searchIndividual(individualsRoot, userID);
+    if (ind == NULL) {
+        printf("User not found!\n");
+        return;
     }
     
-    printf("Enter Amount: ");
-    scanf("%f", &amount);
+    if (expID1 > expID2) {
+        printf("Invalid range!\n");
+        return;
+    }
     
-    while (1) {
-        printf("Enter Day (1-%d): ", DAYS_IN_MONTH);
-        scanf("%d", &day);
-        printf("Enter Month (1-%d): ", MONTHS_IN_YEAR);
-        scanf("%d", &month);
-        
-        if (!isValidDate(day, month)) {
-            printf("Error: Invalid date! Please enter a valid day and month.\n");
-            continue;
+    loadExpenseTrees();
+    ExpenseQuery q;
+    initExpenseQuery(&q);
+    q.userID = userID;
+    q.startID = expID1;
+    q.endID = expID2;
+    
+    // All users, straight from the subtree sums
+    int rangeCount;
+    double rangeSum;
+    expenseRangeTotals(expensesRoot, expID1, expID2, &rangeCount, &rangeSum);
+    
+    char header[256];
+    snprintf(header, sizeof(header), "\nExpenses for %s (ID: %d) between IDs %d and %d:\n",
+             nameOf(ind->userName), userID, expID1, expID2);
+    
+    int shown;
+    float pageTotal;
+    if (pageListing(&q, header, printRangeRow, &shown, &pageTotal)) {
+        if (shown == 0) {
+            printf("No expenses found in this range.\n");
+        } else {
+            printf("Total of the rows shown: %.2f\n", pageTotal);
         }
-        break;
+        printf("All users in this range: %d expense(s), total %.2f\n", rangeCount, rangeSum);
+        printf("\n");
+        return;
     }
     
-    expensesRoot = insertExpense(expensesRoot, expenseID, userID, category, amount, day, month);
+    printf("%s", header);
+    printf("------------------------------------------------\n");
     
-    // Update family expense if user is in a family
-    Family* family = findFamilyByUserID(userID);
-    if (family != NULL) {
-        family->totalExpense += amount;
+    //basically a struct that stores the curr range, this struct is passed 
+    //while traversing so we set the start and end points
+    
+    IDRangeFilter filter = {
+        .userID = userID,
+        .startID = expID1,
+        .endID = expID2,
+        .hasResults = false,
+        .total = 0.0
+    };
+    
+    traverseExpensesWithContext(expensesRoot, idRangeCallback, &filter);
+    
+    if (!filter.hasResults) {
+        printf("No expenses found in this range.\n");
+    } else {
+        printf("Total for %s: %.2f\n", nameOf(ind->userName), filter.total);
     }
     
-    printf("Expense added successfully!\n");
+    printf("All users in this range: %d expense(s), total %.2f\n", rangeCount, rangeSum);
+    printf("\n");
 }
-//handler is a void pointer to the expense tree that is used to traverse
-void traverseExpensesWithContext(Expense* root, void (*handler)(Expense*, void*), void* context) {
-    if (root != NULL) {
-        traverseExpensesWithContext(root->left, handler, context);
-        handler(root, context);
-        traverseExpensesWithContext(root->right, handler, context);
+
+// Batch file format, one record per line ('#' starts a comment):
+//   I <expenseID> <userID> <category> <amount> <day> <month>
+//   U <expenseID> <category> <amount> <day> <month>
+//   D <expenseID>
+void Apply_expense_batch() {
+    char path[256];
+    printf("Enter batch file path: ");
+    scanf("%255s", path);
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        printf("Error opening batch file!\n");
+        return;
+    }
+
+    int capacity = 1024, count = 0, malformed = 0;
+    ExpenseMutation *batch = (ExpenseMutation*)malloc(sizeof(ExpenseMutation) * capacity);
+    char line[256];
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        ExpenseMutation mut = {0};
+        char op;
+        int fields;
+
+        if (sscanf(line, " %c", &op) != 1 || op == '#')
+            continue;
+
+        if (op == 'I') {
+            mut.op = BATCH_INSERT;
+            fields = sscanf(line, " %*c %d %d %d %f %d %d", &mut.expenseID, &mut.userID,
+                            &mut.category, &mut.amount, &mut.day, &mut.month);
+            if (fields != 6) { malformed++; continue; }
+        } else if (op == 'U') {
+            mut.op = BATCH_UPDATE;
+            fields = sscanf(line, " %*c %d %d %f %d %d", &mut.expenseID,
+                            &mut.category, &mut.amount, &mut.day, &mut.month);
+            if (fields != 5) { malformed++; continue; }
+        } else if (op == 'D') {
+            mut.op = BATCH_DELETE;
+            if (sscanf(line, " %*c %d", &mut.expenseID) != 1) { malformed++; continue; }
+        } else {
+            malformed++;
+            continue;
+        }
+
+        if (count == capacity) {
+            capacity *= 2;
+            batch = (ExpenseMutation*)realloc(batch, sizeof(ExpenseMutation) * capacity);
+        }
+        batch[count++] = mut;
     }
+    fclose(file);
+
+    loadExpenseTrees();
+    BatchResult result = applyExpenseBatch(batch, count);
+    free(batch);
+
+    printf("\nBatch applied: %d record(s)\n", count);
+    printf("-------------------------\n");
+    printf("Inserted: %d\n", result.inserted);
+    printf("Updated:  %d\n", result.updated);
+    printf("Deleted:  %d\n", result.deleted);
+    printf("Rejected: %d\n", result.rejected + malformed);
 }
 
-void expenseAccumulatorCallback(Expense* exp, void* context) {
-    ExpenseAccumulator* acc = (ExpenseAccumulator*)context;
-    if (exp->userID == acc->targetUserID) {
-        acc->total += exp->amount;
-        acc->categoriesTotal[exp->category] += exp->amount;
+void Query_expenses() {
+    ExpenseQuery q;
+    initExpenseQuery(&q);
+    int familyID, day1, month1, day2, month2;
+    float amount;
+
+    printf("Enter -1 (or 0 0 for dates) to leave a filter out.\n");
+    printf("User ID: ");
+    scanf("%d", &q.userID);
+    printf("Family ID: ");
+    scanf("%d", &familyID);
+    printCategoryPrompt("subcategories included");
+    scanf("%d", &q.category);
+    printf("Minimum amount: ");
+    scanf("%f", &amount);
+    if (amount != -1) q.minAmount = amount;
+    printf("Maximum amount: ");
+    scanf("%f", &amount);
+    if (amount != -1) q.maxAmount = amount;
+    printf("Start date (day month): ");
+    scanf("%d %d", &day1, &month1);
+    printf("End date (day month): ");
+    scanf("%d %d", &day2, &month2);
+    printf("Start Expense ID: ");
+    scanf("%d", &q.startID);
+    printf("End Expense ID: ");
+    scanf("%d", &q.endID);
+
+    if (familyID >= 0) {
+        q.family = searchFamily(familiesRoot, familyID);
+        if (q.family == NULL) {
+            printf("Family not found!\n");
+            return;
+        }
+    }
+    if (q.category >= categoryCount) {
+        printf("Invalid category!\n");
+        return;
+    }
+    if (day1 != 0 || month1 != 0) {
+        if (!isValidDate(day1, month1)) {
+            printf("Invalid date!\n");
+            return;
+        }
+        q.startDate = month1 * 100 + day1;
+    }
+    if (day2 != 0 || month2 != 0) {
+        if (!isValidDate(day2, month2)) {
+            printf("Invalid date!\n");
+            return;
+        }
+        q.endDate = month2 * 100 + day2;
+    }
+    if (q.startID == -1) q.startID = INT_MIN;
+    if (q.endID == -1) q.endID = INT_MAX;
+
+    QueryCursor cur;
+    openQuery(&cur, &q);
+
+    printf("\nPlan: %s\n", queryPathName(cur.path));
+    printf("------------------------------------------------\n");
+
+    int rows = 0;
+    float total = 0.0;
+    Expense *exp;
+    while ((exp = nextQueryResult(&cur)) != NULL) {
+        Individual *ind = searchIndividual(individualsRoot, exp->userID);
+        printf("ID: %-5d Date: %2d/%-2d %-10s %7.2f (User: %s)\n",
+               exp->expenseID,
+               exp->day, exp->month,
+               categoryName(exp->category),
+               exp->amount,
+               ind ? nameOf(ind->userName) : "Unknown");
+        rows++;
+        total += exp->amount;
+    }
+
+    if (rows == 0) {
+        printf("No expenses match this query.\n");
+    } else {
+        printf("\n%d expense(s), total %.2f\n", rows, total);
     }
+    printf("Rows examined: %d\n\n", cur.scanned);
 }
 
-void Create_Family() {
-    int familyID;
-    char familyName[50];
-    
-    while (1) {
-        printf("Enter Family ID: ");
-        scanf("%d", &familyID);
-        
-        if (familyID < 0) {
-            printf("Error: Family ID cannot be negative. Please enter a positive number.\n");
-            continue;
+void Get_expense_statistics() {
+    int choice;
+    loadExpenseTrees();
+    printf("1. Total of an Expense ID range\n2. Position of an Expense ID\n3. Expense at a position\nEnter choice: ");
+    scanf("%d", &choice);
+
+    if (choice == 1) {
+        int expID1, expID2;
+        printf("Enter start Expense ID: ");
+        scanf("%d", &expID1);
+        printf("Enter end Expense ID: ");
+        scanf("%d", &expID2);
+        if (expID1 > expID2) {
+            printf("Invalid range!\n");
+            return;
         }
-        
-        if (searchFamily(familiesRoot, familyID) != NULL) {
-            printf("Error: Family ID %d already exists. Please enter a different ID.\n", familyID);
-            continue;
+
+        int count;
+        double sum;
+        expenseRangeTotals(expensesRoot, expID1, expID2, &count, &sum);
+        printf("\nExpense IDs %d to %d: %d expense(s), total %.2f\n", expID1, expID2, count, sum);
+    }
+    else if (choice == 2) {
+        int expenseID;
+        printf("Enter Expense ID: ");
+        scanf("%d", &expenseID);
+
+        int rank = expenseRank(expensesRoot, expenseID);
+        if (rank == 0) {
+            printf("Expense not found!\n");
+            return;
         }
-        
-        break;
+        printf("\nExpense %d is number %d of %d in ID order.\n", expenseID, rank, countExpense(expensesRoot));
     }
-    
-    printf("Enter Family Name: ");
-    scanf("%s", familyName);
-    
-    familiesRoot = insertFamily(familiesRoot, familyID, familyName);
-    Family *family = searchFamily(familiesRoot, familyID);
-    
-    int numMembers;
-    while (1) {
-        printf("Enter number of members (1-4): ");
-        scanf("%d", &numMembers);
-        
-        if (numMembers < 1 || numMembers > 4) {
-            printf("Error: Invalid number of members. Must be between 1 and 4.\n");
-            continue;
+    else if (choice == 3) {
+        int k;
+        printf("Enter position (1-%d): ", countExpense(expensesRoot));
+        scanf("%d", &k);
+
+        Expense *exp = selectExpense(expensesRoot, k);
+        if (exp == NULL) {
+            printf("No expense at that position!\n");
+            return;
+        }
+        printf("\nExpense number %d:\n", k);
+        printf("ID: %-5d Date: %2d/%-2d %-10s %7.2f (User ID: %d)\n",
+               exp->expenseID, exp->day, exp->month,
+               categoryName(exp->category), exp->amount, exp->userID);
+    }
+    else {
+        printf("Invalid choice!\n");
+    }
+}
+
+void printAmountRow(AmountNode *node) {
+    Expense *exp = node->expense;
+    printf("ID: %-5d Date: %2d/%-2d %-10s %7.2f (User ID: %d)\n",
+           exp->expenseID, exp->day, exp->month,
+           categoryName(exp->category), exp->amount, exp->userID);
+}
+
+void Get_amount_statistics() {
+    int choice, category;
+    loadExpenseTrees();
+    printf("1. Expenses over an amount\n2. Percentiles\n3. Smallest/Largest N\nEnter choice: ");
+    scanf("%d", &choice);
+    printCategoryPrompt(NULL);
+    scanf("%d", &category);
+
+    if (!isValidCategory(category)) {
+        printf("Invalid category!\n");
+        return;
+    }
+    AmountNode *root = amountIndex[category];
+    int n = countAmount(root);
+
+    if (choice == 1) {
+        float threshold;
+        printf("Enter amount: ");
+        scanf("%f", &threshold);
+
+        int first = countAmountAtMost(root, threshold) + 1;
+        printf("\n%s expenses over %.2f: %d\n", categoryName(category), threshold, n - first + 1);
+        printf("------------------------------------------------\n");
+        for (int k = first; k <= n; k++)
+            printAmountRow(selectAmount(root, k));
+    }
+    else if (choice == 2) {
+        if (n == 0) {
+            printf("No %s expenses.\n", categoryName(category));
+            return;
+        }
+        printf("\n%s expenses: %d\n", categoryName(category), n);
+        printf("------------------------------------------------\n");
+        printf("Min: %.2f\n", selectAmount(root, 1)->amount);
+        printf("p50: %.2f\n", amountPercentile(root, 50)->amount);
+        printf("p90: %.2f\n", amountPercentile(root, 90)->amount);
+        printf("p99: %.2f\n", amountPercentile(root, 99)->amount);
+        printf("Max: %.2f\n", selectAmount(root, n)->amount);
+    }
+    else if (choice == 3) {
+        int count;
+        printf("Enter N: ");
+        scanf("%d", &count);
+        if (count > n) count = n;
+
+        printf("\nSmallest %d %s expenses:\n", count, categoryName(category));
+        printf("------------------------------------------------\n");
+        for (int k = 1; k <= count; k++)
+            printAmountRow(selectAmount(root, k));
+
+        printf("\nLargest %d %s expenses:\n", count, categoryName(category));
+        printf("------------------------------------------------\n");
+        for (int k = n; k > n - count; k--)
+            printAmountRow(selectAmount(root, k));
+    }
+    else {
+        printf("Invalid choice!\n");
+    }
+    printf("\n");
+}
+
+// Family reports against an older expense version. Membership and incomes
+// are taken from the current state; only expenses are versioned.
+void Reports_as_of() {
+    int choice, familyID;
+    long long versionID;
+    loadExpenseTrees();
+    if (versionCount == 0) {
+        printf("No expense versions recorded yet.\n");
+        return;
+    }
+    // History starts with this session: versions live in memory only
+    char since[32];
+    strftime(since, sizeof(since), "%Y-%m-%d %H:%M", localtime(&versions[0].committedAt));
+    printf("Versions %llu to %llu available, back to %s. The newest %d are all kept; before\n"
+           "those, the last version of each of the past %d days. Earlier sessions are not kept.\n",
+           (unsigned long long)versions[0].id,
+           (unsigned long long)versions[versionCount - 1].id, since,
+           RETAINED_VERSIONS, RETAINED_DAYS);
+    printf("Enter version (0 to pick by date/time): ");
+    scanf("%lld", &versionID);
+
+    Version *v;
+    if (versionID == 0) {
+        char date[16], clock[8];
+        struct tm when;
+        memset(&when, 0, sizeof(when));
+        printf("Enter date and time (YYYY-MM-DD HH:MM): ");
+        scanf("%15s %7s", date, clock);
+        if (sscanf(date, "%d-%d-%d", &when.tm_year, &when.tm_mon, &when.tm_mday) != 3 ||
+            sscanf(clock, "%d:%d", &when.tm_hour, &when.tm_min) != 2) {
+            printf("Invalid date/time!\n");
+            return;
         }
-        break;
+        when.tm_year -= 1900;
+        when.tm_mon -= 1;
+        when.tm_isdst = -1;
+        v = findVersionAsOf(mktime(&when));
+    } else {
+        v = findVersion((uint64_t)versionID);
     }
-    
-    for (int i = 0; i < numMembers; i++) {
-        int userID;
-        
-        while (1) {
-            printf("Enter User ID for member %d: ", i+1);
-            scanf("%d", &userID);
-            
-            Individual *ind = searchIndividual(individualsRoot, userID);
-            if (ind == NULL) {
-                printf("Error: User not found. Please enter a valid user ID.\n");
-                continue;
-            }
-            
-            // Check if user is already in another family
-            Family* existingFamily = NULL;
-            searchFamilies(familiesRoot, userID, &existingFamily);
-            if (existingFamily != NULL && existingFamily != family) {
-                printf("Error: User %s (ID: %d) is already a member of family %s.\n", 
-                      ind->userName, userID, existingFamily->familyName);
-                continue;
-            }
-            
-            addFamilyMember(family, userID);
-            break;
+    if (v == NULL) {
+        printf("Version not available!\n");
+        return;
+    }
+
+    uint64_t id = v->id;
+    VersionNode *root = v->root;
+    time_t committedAt = v->committedAt;
+    pinVersion(id);
+
+    printf("1. Total Family Expense\n2. Highest Expense Day\nEnter choice: ");
+    scanf("%d", &choice);
+    printf("Enter Family ID: ");
+    scanf("%d", &familyID);
+
+    Family *family = searchFamily(familiesRoot, familyID);
+    if (family == NULL) {
+        printf("Family not found!\n");
+        unpinVersion(id);
+        return;
+    }
+
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&committedAt));
+    printf("\nFamily %s as of version %llu (%s)\n", nameOf(family->familyName),
+           (unsigned long long)id, stamp);
+    printf("------------------------------------------------\n");
+
+    if (choice == 1) {
+        float total = 0;
+        CategoryMap categoriesTotal = {0};
+        for (int i = 0; i < family->memberCount; i++) {
+            ExpenseAccumulator acc = {
+                .targetUserID = family->members[i],
+                .total = 0
+            };
+            traverseVersionWithContext(root, expenseAccumulatorCallback, &acc);
+            total += acc.total;
+            mergeCategoryAmounts(&categoriesTotal, &acc.categoriesTotal);
+            categoryMapFree(&acc.categoriesTotal);
         }
+        for (int i = 0; i < categoriesTotal.count; i++)
+            printf("%-12s %.2f\n", categoryName(categoriesTotal.keys[i]),
+                   *(float*)categoryMapAt(&categoriesTotal, i, sizeof(float)));
+        categoryMapFree(&categoriesTotal);
+        printf("Total:       %.2f\n", total);
+        printf("Income:      %.2f\n", family->totalIncome);
     }
-    
-    // Calculate total monthly expenses for the family
-    family->totalExpense = 0.0;
-    FamilyMember *member = family->members;
-    while (member != NULL) {
-        ExpenseAccumulator acc = {
-            .targetUserID = member->userID,
-            .total = 0
+    else if (choice == 2) {
+        DailyExpenseTracker tracker = {
+            .family = family,
+            .dailyExpenses = {{0}}
         };
-        traverseExpensesWithContext(expensesRoot, expenseAccumulatorCallback, &acc);
-        family->totalExpense += acc.total;
-        member = member->next;
+        traverseVersionWithContext(root, dailyExpenseCallback, &tracker);
+
+        int maxDay, maxMonth;
+        float maxExpense = highestExpenseDay(tracker.dailyExpenses, &maxDay, &maxMonth);
+        if (maxExpense > 0)
+            printf("Highest expense day: %d/%d/25 with total expense: %.2f\n", maxDay, maxMonth, maxExpense);
+        else
+            printf("No expenses found for this family.\n");
     }
-    
-    printf("\nFamily created successfully!\n");
-    printf("Family Name: %s\n", family->familyName);
-    printf("Total Members: %d\n", numMembers);
-    printf("Total Monthly Income: %.2f\n", family->totalIncome);
-    printf("Total Monthly Expenses: %.2f\n", family->totalExpense);
-    
-    float balance = family->totalIncome - family->totalExpense;
-    if (balance >= 0) {
-        printf("Remaining Balance: %.2f\n", balance);
-    } else {
-        printf("Deficit: %.2f\n", -balance);
+    else {
+        printf("Invalid choice!\n");
+    }
+    unpinVersion(id);
+    printf("\n");
+}
+
+void Undo_and_history() {
+    int choice, id;
+    printf("1. Undo Last Operations\n2. Expense History\n3. Individual History\n4. Family History\n5. Recurring Expense History\nEnter choice: ");
+    scanf("%d", &choice);
+
+    if (choice == 1) {
+        int n, failed;
+        printf("Number of operations to undo: ");
+        scanf("%d", &n);
+        loadExpenseTrees();
+        int undone = undoJournal(n, &failed);
+        printf("Undid %d operation(s).\n", undone);
+        if (failed > 0)
+            printf("%d change(s) could not be restored because the record changed since.\n", failed);
+        if (undone < n && journalCount == 0)
+            printf("No more operations to undo.\n");
+        else if (undone < n && journal[(journalHead + journalCount - 1) % JOURNAL_CAPACITY].op <= journalBarrierOp)
+            printf("Stopped at a budget or category change, which cannot be undone.\n");
+        else if (undone < n)
+            printf("Older operations are no longer in memory and cannot be undone.\n");
+        return;
+    }
+    if (choice < 2 || choice > 5) {
+        printf("Invalid choice!\n");
+        return;
     }
+
+    printf("Enter ID: ");
+    scanf("%d", &id);
+    printf("\nHistory (values before each change, after for adds):\n");
+    printf("------------------------------------------------\n");
+    int found;
+    if (choice == 2)
+        found = printRecordHistory(JOURNAL_EXPENSE_ADD, JOURNAL_EXPENSE_DELETE, id);
+    else if (choice == 3)
+        found = printRecordHistory(JOURNAL_INDIVIDUAL_ADD, JOURNAL_INDIVIDUAL_DELETE, id);
+    else if (choice == 4)
+        found = printRecordHistory(JOURNAL_FAMILY_ADD, JOURNAL_FAMILY_DELETE, id);
+    else
+        found = printRecordHistory(JOURNAL_RULE_ADD, JOURNAL_RULE_DELETE, id);
+    if (found == 0)
+        printf("No changes recorded this session.\n");
+    printf("\n");
 }
 
-void Update_or_delete_Individual_Family_details() {
+// Reports through the family shards, plus a throughput benchmark that
+// reruns the global reports with 1 to MAX_SHARDS shards
+void Sharded_reports() {
     int choice;
-    printf("1. Update Individual\n2. Delete Individual\n3. Update Family\n4. Delete Family\nEnter choice: ");
+    printf("1. Expenses in Date Range (all shards)\n2. Top K Expenses\n3. Family Category Totals\n4. Shard Throughput Benchmark\nEnter choice: ");
     scanf("%d", &choice);
-    
+
+    rebuildShards();
+    ExpenseQuery q;
+    initExpenseQuery(&q);
+
     if (choice == 1) {
-        int userID;
-        printf("Enter User ID to update: ");
-        scanf("%d", &userID);
-        
-        Individual *ind = searchIndividual(individualsRoot, userID);
-    
-        if (ind == NULL) {
-            printf("User not found!\n");
+        int day1, month1, day2, month2;
+        printf("Enter start date (day month): ");
+        scanf("%d %d", &day1, &month1);
+        printf("Enter end date (day month): ");
+        scanf("%d %d", &day2, &month2);
+        if (!isValidDate(day1, month1) || !isValidDate(day2, month2)) {
+            printf("Invalid date!\n");
             return;
         }
-        
-        // Display current details
-        printf("\nCurrent details:\n");
-        printf("----------------\n");
-        printf("User ID: %d\n", ind->userID);
-        printf("Name: %s\n", ind->userName);
-        printf("Income: %.2f\n", ind->income);
-        
-        // Get updates
-        printf("\nEnter new details (enter '-' to keep current value):\n");
-        
-        printf("Name (%s): ", ind->userName);
-        char newName[50];
-        scanf("%s", newName);
-        
-        printf("Income (%.2f): ", ind->income);
-        float newIncome;
-        scanf("%f", &newIncome);
-        
-        // Store old values for comparison
-        char oldName[50];
-        strcpy(oldName, ind->userName);
-        float oldIncome = ind->income;
-        
-        // Apply updates
-        if (strcmp(newName, "-") != 0) {
-            strcpy(ind->userName, newName);
-        }
-        
-        if (newIncome != -1) {
-            // Update family incomes if this user is in any families
-            Family* family = findFamilyByUserID(userID);
-            if (family != NULL) {
-                family->totalIncome += (newIncome - ind->income);
-            }
-            ind->income = newIncome;
+        q.startDate = month1 * 100 + day1;
+        q.endDate = month2 * 100 + day2;
+
+        Expense **rows = (Expense**)malloc(sizeof(Expense*) * (countExpense(expensesRoot) + 1));
+        int n = shardedScan(&q, rows);
+        float total = 0;
+        printf("\nExpenses between %d/%d/25 and %d/%d/25 (%d shards):\n", day1, month1, day2, month2, shardCount);
+        printf("------------------------------------------------\n");
+        for (int i = 0; i < n; i++) {
+            printPeriodRow(rows[i]);
+            total += rows[i]->amount;
         }
-        
-        // Display updated details
-        printf("\nUpdate successful!\n");
-        printf("\nBefore update:\n");
-        printf("-------------\n");
-        printf("Name: %s\n", oldName);
-        printf("Income: %.2f\n", oldIncome);
-        
-        printf("\nAfter update:\n");
-        printf("------------\n");
-        printf("Name: %s\n", ind->userName);
-        printf("Income: %.2f\n", ind->income);
+        printf("%d expense(s), total %.2f\n", n, total);
+        free(rows);
     }
     else if (choice == 2) {
-    int userID;
-    printf("Enter User ID to delete: ");
-    scanf("%d", &userID);
-    
-    Individual *ind = searchIndividual(individualsRoot, userID);
-    if (ind == NULL) {
-        printf("User not found!\n");
-        return;
-    }
-    
-  
-    printf("\nUser to be deleted:\n");
-    printf("------------------\n");
-    printf("User ID: %d\n", ind->userID);
-    printf("Name: %s\n", ind->userName);
-    printf("Income: %.2f\n", ind->income);
-    
-    char confirm;
-    printf("\nAre you sure you want to delete this user? (y/n): ");
-    scanf(" %c", &confirm);
-    
-    if (confirm == 'y' || confirm == 'Y') {
-       
-        Family* family = findFamilyByUserID(userID);
-        if (family != NULL) {
-            int flag=1;
-            FamilyMember **ptr = &(family->members);
-            while (*ptr != NULL && flag) {
-                if ((*ptr)->userID == userID) {
-                    FamilyMember *toDelete = *ptr;
-                    *ptr = (*ptr)->next;
-                    free(toDelete);
-                    family->totalIncome -= ind->income;
-                    flag=0;
-                    break;
-                }
-                ptr = &((*ptr)->next);
-            }
-            
-            // Checking if this was the last member
-            if (family->members == NULL) {
-                printf("\nThis was the last member of family %s (ID: %d).\n", 
-                      family->familyName, family->familyID);
-                printf("The family will also be deleted.\n");
-                
-                familiesRoot = deleteFamily(familiesRoot, family->familyID);
-            }
+        int k;
+        printf("Enter K: ");
+        scanf("%d", &k);
+        if (k <= 0) {
+            printf("Invalid K!\n");
+            return;
         }
-        
-        individualsRoot = deleteIndividual(individualsRoot, userID);
-        printf("User Deleted Successfully!\n");
-    } else {
-        printf("Deletion cancelled.\n");
+        Expense **rows = (Expense**)malloc(sizeof(Expense*) * k);
+        int n = shardedTopAmounts(&q, k, rows);
+        printf("\nTop %d expenses:\n", n);
+        printf("------------------------------------------------\n");
+        for (int i = 0; i < n; i++)
+            printPeriodRow(rows[i]);
+        free(rows);
     }
-	}
     else if (choice == 3) {
         int familyID;
-        printf("Enter Family ID to update: ");
+        printf("Enter Family ID: ");
         scanf("%d", &familyID);
-        
-        Family *fam = searchFamily(familiesRoot, familyID);
-        if (fam == NULL) {
+        Family *family = searchFamily(familiesRoot, familyID);
+        if (family == NULL) {
             printf("Family not found!\n");
             return;
         }
-        
-        // Display current details
-        printf("\nCurrent family details:\n");
-        printf("----------------------\n");
-        printf("Family ID: %d\n", fam->familyID);
-        printf("Name: %s\n", fam->familyName);
-        printf("Members: %d\n", countMembers(fam));
-        printf("Total Income: %.2f\n", fam->totalIncome);
-        printf("Total Expenses: %.2f\n", fam->totalExpense);
-        
-        // Get updates
-        printf("\nEnter new details (enter '-' to keep current value):\n");
-        printf("Name (%s): ", fam->familyName);
-        char newName[50];
-        scanf("%s", newName);
-        
-        // Store old value for comparison
-        char oldName[50];
-        strcpy(oldName, fam->familyName);
-        
-        // Apply updates
-        if (strcmp(newName, "-") != 0) {
-            strcpy(fam->familyName, newName);
-        }
-        
-        // Display updated details
-        printf("\nUpdate successful!\n");
-        printf("\nBefore update:\n");
-        printf("-------------\n");
-        printf("Name: %s\n", oldName);
-        
-        printf("\nAfter update:\n");
-        printf("------------\n");
-        printf("Name: %s\n", fam->familyName);
+        const CategoryMap *totals = shardedFamilyTotals(family);
+        printf("\nFamily %s (shard %d of %d)\n", nameOf(family->familyName), shardOfFamily(family), shardCount);
+        printf("------------------------------------------------\n");
+        for (int i = 0; i < totals->count; i++)
+            printf("%-12s %.2f\n", categoryName(totals->keys[i]), *(double*)categoryMapAt(totals, i, sizeof(double)));
     }
     else if (choice == 4) {
-    int familyID;
-    printf("Enter Family ID to delete: ");
+        int rounds;
+        printf("Queries per shard count: ");
+        scanf("%d", &rounds);
+        if (rounds <= 0) rounds = 1;
+
+        int previous = shardCount;
+        Expense **rows = (Expense**)malloc(sizeof(Expense*) * (countExpense(expensesRoot) + 10));
+        printf("\nShards  Rows/shard (min-max)  Period scans/s  Top-10/s\n");
+        printf("--------------------------------------------------------\n");
+        for (int n = 1; n <= MAX_SHARDS; n *= 2) {
+            setShardCount(n);
+            rebuildShards();
+            int minRows = INT_MAX, maxRows = 0;
+            for (int i = 0; i < n; i++) {
+                if (shards[i].count < minRows) minRows = shards[i].count;
+                if (shards[i].count > maxRows) maxRows = shards[i].count;
+            }
+
+            ExpenseQuery period;
+            initExpenseQuery(&period);
+            period.startDate = 101;
+            period.endDate = 610;
+            double start = nowMs();
+            for (int r = 0; r < rounds; r++)
+                shardedScan(&period, rows);
+            double scanMs = nowMs() - start;
+
+            start = nowMs();
+            for (int r = 0; r < rounds; r++)
+                shardedTopAmounts(&q, 10, rows);
+            double topMs = nowMs() - start;
+
+            printf("%6d  %9d-%-9d  %14.1f  %8.1f\n", n, minRows, maxRows,
+                   rounds * 1000.0 / (scanMs > 0 ? scanMs : 1),
+                   rounds * 1000.0 / (topMs > 0 ? topMs : 1));
+        }
+        setShardCount(previous);
+        free(rows);
+        printf("Family placement decides the balance: with few families most rows share a shard.\n");
+    }
+    else {
+        printf("Invalid choice!\n");
+    }
+    printf("\n");
+}
+
+int compareAnomalyScores(const void *a, const void *b) {
+    const Expense *x = *(const Expense**)a;
+    const Expense *y = *(const Expense**)b;
+    return (x->anomalyScore < y->anomalyScore) - (x->anomalyScore > y->anomalyScore);
+}
+
+// Reads the flagged list only; nothing is rescanned
+void Get_anomalous_expenses() {
+    int choice;
+    loadExpenseTrees();
+    printf("1. All Flagged Expenses\n2. Flagged Expenses of a User\n3. Spending Profile of a User\nEnter choice: ");
+    scanf("%d", &choice);
+
+    int userID = -1;
+    if (choice == 2 || choice == 3) {
+        printf("Enter User ID: ");
+        scanf("%d", &userID);
+    }
+
+    if (choice == 1 || choice == 2) {
+        Expense **rows = (Expense**)malloc(sizeof(Expense*) * (flaggedCount + 1));
+        int n = 0;
+        for (Expense *exp = flaggedExpenses; exp != NULL; exp = exp->nextFlagged)
+            if (userID < 0 || exp->userID == userID)
+                rows[n++] = exp;
+        qsort(rows, n, sizeof(Expense*), compareAnomalyScores);
+
+        printf("\nFlagged expenses (score >= %.1f): %d\n", ANOMALY_THRESHOLD, n);
+        printf("------------------------------------------------\n");
+        for (int i = 0; i < n; i++) {
+            Individual *ind = searchIndividual(individualsRoot, rows[i]->userID);
+            printf("ID: %-5d Date: %2d/%-2d %-10s %9.2f score %5.1f (User: %s)\n",
+                   rows[i]->expenseID, rows[i]->day, rows[i]->month,
+                   categoryName(rows[i]->category), rows[i]->amount, rows[i]->anomalyScore,
+                   ind ? nameOf(ind->userName) : "Unknown");
+        }
+        free(rows);
+    }
+    else if (choice == 3) {
+        Individual *ind = searchIndividual(individualsRoot, userID);
+        if (ind == NULL) {
+            printf("User not found!\n");
+            return;
+        }
+        printf("\nSpending profile of %s\n", nameOf(ind->userName));
+        printf("------------------------------------------------\n");
+        printf("%-12s %6s %10s %10s\n", "Category", "Count", "Mean", "Std dev");
+        for (int i = 0; i < ind->spend.count; i++) {
+            SpendStats *st = (SpendStats*)categoryMapAt(&ind->spend, i, sizeof(SpendStats));
+            if (st->n > 0)
+                printf("%-12s %6ld %10.2f %10.2f\n", categoryName(ind->spend.keys[i]), st->n,
+                       st->mean, spendStdDev(st));
+        }
+    }
+    else {
+        printf("Invalid choice!\n");
+    }
+    printf("\n");
+}
+
+void printBudgetRow(Family *family, int slot) {
+    const char *what = budgetSlotName(slot);
+    Budget *budget = familyBudget(family, slot);
+    float spent = familySpend(family, slot);
+    if (budget != NULL && budget->limit > 0) {
+        printf("%-12s %10.2f %10.2f %5.0f%%%s\n", what, spent, budget->limit, spent * 100 / budget->limit,
+               budget->alertLevel == 2 ? "  EXCEEDED" :
+               budget->alertLevel == 1 ? "  WARNING" : "");
+    } else {
+        printf("%-12s %10.2f %10s\n", what, spent, "-");
+    }
+}
+
+void Family_budgets() {
+    int choice, familyID;
+    printf("1. Set Budget\n2. Budget Status\nEnter choice: ");
+    scanf("%d", &choice);
+    printf("Enter Family ID: ");
     scanf("%d", &familyID);
 
-    Family *fam = searchFamily(familiesRoot, familyID);
-    if (fam == NULL) {
+    Family *family = searchFamily(familiesRoot, familyID);
+    if (family == NULL) {
         printf("Family not found!\n");
         return;
-    }
-    
-    // Display details before deletion
-    printf("\nFamily to be deleted:\n");
-    printf("--------------------\n");
-    printf("Family ID: %d\n", fam->familyID);
-    printf("Name: %s\n", fam->familyName);
-    printf("Members: %d\n", countMembers(fam));
-    printf("Total Income: %.2f\n", fam->totalIncome);
-    printf("Total Expenses: %.2f\n", fam->totalExpense);
-    
-    char confirm;
-    printf("\nAre you sure you want to delete this family? (y/n): ");
-    scanf(" %c", &confirm);
-    
-    if (confirm == 'y' || confirm == 'Y') {
-    
-        FamilyMember *current = fam->members;
-        while (current != NULL) {
-            FamilyMember *next = current->next;
-            
-            free(current);
-            current = next;
+    }
+
+    if (choice == 1) {
+        int category;
+        float limit;
+        printCategoryPrompt("-1 for the family total");
+        scanf("%d", &category);
+        if (category != FAMILY_TOTAL && !isValidCategory(category)) {
+            printf("Invalid category!\n");
+            return;
+        }
+        printf("Enter budget (0 to remove): ");
+        scanf("%f", &limit);
+        if (limit < 0) {
+            printf("Invalid budget!\n");
+            return;
+        }
+        journalBarrier();
+        if (limit == 0) {
+            categoryMapRemove(&family->budgets, category, sizeof(Budget));
+            printf("Budget removed.\n");
+            return;
+        }
+        Budget *budget = (Budget*)categoryMapGet(&family->budgets, category, sizeof(Budget));
+        budget->limit = limit;
+        // A budget that is already breached alerts right away
+        budget->alertLevel = 0;
+        checkBudget(family, category);
+        printf("Budget set.\n");
+    }
+    else if (choice == 2) {
+        printf("\nBudgets of family %s\n", nameOf(family->familyName));
+        printf("------------------------------------------------\n");
+        printf("%-12s %10s %10s %6s\n", "Category", "Spent", "Budget", "Used");
+        // Categories with spending or a budget, from the two sparse maps
+        const CategoryMap *spent = &family->categoryExpense, *budgets = &family->budgets;
+        printBudgetRow(family, FAMILY_TOTAL);
+        int i = 0, j = 0;
+        while (i < spent->count || j < budgets->count) {
+            int a = i < spent->count ? spent->keys[i] : INT_MAX;
+            int b = j < budgets->count ? budgets->keys[j] : INT_MAX;
+            int slot = a < b ? a : b;
+            if (a == slot) i++;
+            if (b == slot) j++;
+            if (slot != FAMILY_TOTAL)
+                printBudgetRow(family, slot);
         }
-        
-        familiesRoot = deleteFamily(familiesRoot, familyID);
-        printf("Family Deleted.\n");
-    } else {
-        printf("Deletion cancelled.\n");
     }
+    else {
+        printf("Invalid choice!\n");
+    }
+    printf("\n");
 }
+
+// Posts every recurring occurrence up to and including month as real
+// expenses, in one batch with fresh IDs above the current maximum
+BatchResult postRecurringThrough(int month) {
+    loadExpenseTrees();
+    int capacity = 0;
+    for (int i = 0; i < ruleCount; i++)
+        capacity += rules[i].endMonth - rules[i].postedThrough;
+    ExpenseMutation *batch = (ExpenseMutation*)malloc(sizeof(ExpenseMutation) * (capacity + 1));
+
+    int total = countExpense(expensesRoot);
+    int nextID = total > 0 ? selectExpense(expensesRoot, total)->expenseID + 1 : 1;
+    int n = 0;
+    for (int i = 0; i < ruleCount; i++) {
+        RecurringRule *rule = &rules[i];
+        int last = rule->endMonth < month ? rule->endMonth : month;
+        for (int m = rule->postedThrough + 1; m <= last; m++) {
+            ExpenseMutation *mut = &batch[n];
+            mut->op = BATCH_INSERT;
+            mut->expenseID = nextID++;
+            mut->userID = rule->userID;
+            mut->category = rule->category;
+            mut->amount = rule->amount;
+            mut->day = rule->day;
+            mut->month = m;
+            mut->seq = n;
+            n++;
+        }
+        // Shipped ahead of the expenses, so a replica never projects an
+        // occurrence it has also received as a real expense
+        if (rule->postedThrough < last) {
+            journalRule(JOURNAL_RULE_UPDATE, rule);
+            rule->postedThrough = last;
+            shipRule(rule);
+        }
+    }
+
+    BatchResult result = applyExpenseBatch(batch, n);
+    free(batch);
+    return result;
 }
 
-void Update_delete_expense() {
+void Recurring_expenses() {
     int choice;
-    printf("1. Update Expense\n2. Delete Expense\nEnter choice: ");
+    printf("1. Add Recurring Expense\n2. List Recurring Expenses\n3. Delete Recurring Expense\n4. Post Recurring Expenses Through Month\nEnter choice: ");
     scanf("%d", &choice);
-    
+
     if (choice == 1) {
-        int expenseID;
-        printf("Enter Expense ID to update: ");
-        scanf("%d", &expenseID);
-        
-        Expense *exp = searchExpense(expensesRoot, expenseID);
-        if (exp == NULL) {
-            printf("Expense not found!\n");
+        int userID, category, day, startMonth, endMonth;
+        float amount;
+        printf("Enter User ID: ");
+        scanf("%d", &userID);
+        if (searchIndividual(individualsRoot, userID) == NULL) {
+            printf("User not found!\n");
             return;
         }
-        
-        printf("Current details:\n");
-        printf("User ID: %d\nCategory: %s\nAmount: %.2f\nDate: %d/%d\n", 
-               exp->userID, categories[exp->category], exp->amount, exp->day, exp->month);
-        
-        printf("Enter new category (0-Rent, 1-Utility, 2-Grocery, 3-Stationary, 4-Leisure or -1 to keep): ");
-        int newCategory;
-        scanf("%d", &newCategory);
-        if (newCategory >= 0 && newCategory < CATEGORIES) {
-            exp->category = newCategory;
-        }
-        
-        printf("Enter new amount (or -1 to keep): ");
-        float newAmount;
-        scanf("%f", &newAmount);
-        if (newAmount != -1) {
-            // Update family total if needed
-            Family* family = findFamilyByUserID(exp->userID);
-            if (family != NULL) {
-                family->totalExpense += (newAmount - exp->amount);
-            }
-            exp->amount = newAmount;
-        }
-        
-        printf("Enter new day (1-10 or -1 to keep): ");
-        int newDay;
-        scanf("%d", &newDay);
-        if (newDay >= 1 && newDay <= DAYS_IN_MONTH) {
-            exp->day = newDay;
-        }
-        
-        printf("Enter new month (1-12 or -1 to keep): ");
-        int newMonth;
-        scanf("%d", &newMonth);
-        if (newMonth >= 1 && newMonth <= 12) {
-            exp->month = newMonth;
+        printCategoryPrompt(NULL);
+        scanf("%d", &category);
+        printf("Enter Amount: ");
+        scanf("%f", &amount);
+        printf("Enter Day of month (1-%d): ", DAYS_IN_MONTH);
+        scanf("%d", &day);
+        printf("Enter first and last month (e.g. 1 12): ");
+        scanf("%d %d", &startMonth, &endMonth);
+
+        if (!isValidCategory(category) || amount <= 0 ||
+            !isValidDate(day, startMonth) || !isValidDate(day, endMonth) || startMonth > endMonth) {
+            printf("Invalid recurring expense!\n");
+            return;
         }
-        
-        printf("Expense updated successfully!\n");
+        RecurringRule *rule = addRecurringRule(userID, category, amount, day, startMonth, endMonth);
+        journalRule(JOURNAL_RULE_ADD, rule);
+        shipRule(rule);
+        printf("Recurring expense R%d added.\n", rule->ruleID);
     }
     else if (choice == 2) {
-        int expenseID;
-        printf("Enter Expense ID to delete: ");
-        scanf("%d", &expenseID);
-
-        Expense *exp = searchExpense(expensesRoot, expenseID);
-        if (exp == NULL) {
-            printf("Expense not found!\n");
-            return;
+        printf("\n%-6s %-8s %-10s %9s %4s %-7s %s\n", "Rule", "User", "Category", "Amount", "Day", "Months", "Posted");
+        printf("------------------------------------------------------------\n");
+        for (int i = 0; i < ruleCount; i++) {
+            RecurringRule *rule = &rules[i];
+            printf("R%-5d %-8d %-10s %9.2f %4d %2d-%-4d %d\n", rule->ruleID, rule->userID,
+                   categoryName(rule->category), rule->amount, rule->day,
+                   rule->startMonth, rule->endMonth,
+                   rule->postedThrough >= rule->startMonth ? rule->postedThrough : 0);
         }
-        
-        // Update family total if needed
-        Family* family = findFamilyByUserID(exp->userID);
-        if (family != NULL) {
-            family->totalExpense -= exp->amount;
+        if (ruleCount == 0)
+            printf("No recurring expenses.\n");
+    }
+    else if (choice == 3) {
+        int ruleID;
+        printf("Enter Rule number: ");
+        scanf("%d", &ruleID);
+        if (removeRecurringRule(ruleID))
+            printf("Recurring expense deleted. Expenses already posted are kept.\n");
+        else
+            printf("Recurring expense not found!\n");
+    }
+    else if (choice == 4) {
+        int month;
+        printf("Post through month (1-12): ");
+        scanf("%d", &month);
+        if (month < 1 || month > MONTHS_IN_YEAR) {
+            printf("Invalid month!\n");
+            return;
         }
-        
-        expensesRoot = deleteExpense(expensesRoot, expenseID);
-        printf("Expense deleted!\n");
+        BatchResult result = postRecurringThrough(month);
+        printf("Posted %d recurring expense(s).\n", result.inserted);
     }
     else {
         printf("Invalid choice!\n");
     }
+    printf("\n");
 }
 
-
-
-// Callback function for accumulating expenses
-void individualExpenseCallback(Expense* exp, void* context) {
-    ExpenseAccumulator* acc = (ExpenseAccumulator*)context;
-    if (exp->userID == acc->targetUserID) {
-        acc->total += exp->amount;
-        acc->categoriesTotal[exp->category] += exp->amount;
+void listProjectedShortfalls(Family *node, int month, int *count) {
+    if (node == NULL) return;
+    listProjectedShortfalls(node->left, month, count);
+    float projected = 0.0;
+    int first, last;
+    trendMonthRange(node, month, &first, &last);
+    for (int i = first; i < last; i++)
+        projected += forecastTrendEntry(node, i).projected;
+    if (projected > node->totalIncome) {
+        printf("%-8d %-20s %10.2f %12.2f %12.2f\n", node->familyID, nameOf(node->familyName),
+               node->totalIncome, projected, node->totalIncome - projected);
+        (*count)++;
     }
+    listProjectedShortfalls(node->right, month, count);
 }
 
-void Get_individual_expense() {
-    int userID;
-    printf("Enter User ID: ");
-    scanf("%d", &userID);
-    
-    Individual *ind = searchIndividual(individualsRoot, userID);
-    if (ind == NULL) {
-        printf("User not found!\n");
+// Forecasts come from the running sums in each family, so neither option
+// looks at a single expense
+void Monthly_forecast() {
+    int choice, month;
+    printf("1. Forecast Family Month\n2. Families Projected to Overspend\nEnter choice: ");
+    scanf("%d", &choice);
+    if (choice != 1 && choice != 2) {
+        printf("Invalid choice!\n");
         return;
     }
-    
-    ExpenseAccumulator acc = {
-        .targetUserID = userID,
-        .total = 0,
-        .categoriesTotal = {0}
-    };
-    
-    // Traverse expenses with context
-    traverseExpensesWithContext(expensesRoot, individualExpenseCallback, &acc);
-    
-    // Display results
-    printf("\nExpense Report for %s (ID: %d)\n", ind->userName, userID);
-    printf("--------------------------------\n");
-    printf("Total Monthly Expense: %.2f\n\n", acc.total);
-    
-    // Sort categories by amount (descending)
-    int sorted[CATEGORIES] = {0,1,2,3,4};
-    for(int i=0; i<CATEGORIES-1; i++) {
-        for(int j=0; j<CATEGORIES-i-1; j++) {
-            if(acc.categoriesTotal[sorted[j]] < acc.categoriesTotal[sorted[j+1]]) {
-                int temp = sorted[j];
-                sorted[j] = sorted[j+1];
-                sorted[j+1] = temp;
-            }
+
+    if (choice == 1) {
+        int familyID;
+        printf("Enter Family ID: ");
+        scanf("%d", &familyID);
+        Family *family = searchFamily(familiesRoot, familyID);
+        if (family == NULL) {
+            printf("Family not found!\n");
+            return;
+        }
+        printf("Enter Month (1-12): ");
+        scanf("%d", &month);
+        if (month < 1 || month > MONTHS_IN_YEAR) {
+            printf("Invalid month!\n");
+            return;
+        }
+
+        int lastDay = family->trendLastDay[month - 1];
+        printf("\nFamily: %s (ID: %d), month %d\n", nameOf(family->familyName), family->familyID, month);
+        if (lastDay == 0) {
+            printf("No expenses in this month yet.\n\n");
+            return;
+        }
+        printf("Based on days 1-%d of %d\n", lastDay, DAYS_IN_MONTH);
+        printf("\n%-12s %10s %10s %12s %10s\n", "Category", "Spent", "Per Day", "Projected", "Of Income");
+        printf("----------------------------------------------------------\n");
+        Forecast total = {0, 0, 0};
+        int first, last;
+        trendMonthRange(family, month, &first, &last);
+        for (int i = first; i < last; i++) {
+            Forecast f = forecastTrendEntry(family, i);
+            int c = family->trend.keys[i] % MAX_CATEGORIES;
+            if (f.spent == 0 && f.projected == 0)
+                continue;
+            total.spent += f.spent;
+            total.perDay += f.perDay;
+            total.projected += f.projected;
+            if (family->totalIncome > 0)
+                printf("%-12s %10.2f %10.2f %12.2f %9.1f%%\n", categoryName(c), f.spent, f.perDay,
+                       f.projected, f.projected * 100 / family->totalIncome);
+            else
+                printf("%-12s %10.2f %10.2f %12.2f %10s\n", categoryName(c), f.spent, f.perDay, f.projected, "-");
         }
+        printf("----------------------------------------------------------\n");
+        printf("%-12s %10.2f %10.2f %12.2f\n", "Total", total.spent, total.perDay, total.projected);
+
+        float balance = family->totalIncome - total.projected;
+        printf("\nMonthly Income:            %.2f\n", family->totalIncome);
+        printf("Projected Month-End Spend: %.2f\n", total.projected);
+        if (balance >= 0)
+            printf("Projected Balance:         %.2f\n", balance);
+        else
+            printf("Projected Deficit:         %.2f\n", -balance);
     }
-    
-    // Print breakdown
-    printf("Category Breakdown:\n");
-    printf("-------------------\n");
-    for(int i=0; i<CATEGORIES; i++) {
-        int cat = sorted[i];
-        if(acc.categoriesTotal[cat] > 0) {
-            printf("%-10s: %.2f (%.1f%%)\n", 
-                  categories[cat], 
-                  acc.categoriesTotal[cat],
-                  (acc.categoriesTotal[cat]/acc.total)*100);
+    else {
+        printf("Enter Month (1-12): ");
+        scanf("%d", &month);
+        if (month < 1 || month > MONTHS_IN_YEAR) {
+            printf("Invalid month!\n");
+            return;
         }
+        int count = 0;
+        printf("\n%-8s %-20s %10s %12s %12s\n", "Family", "Name", "Income", "Projected", "Balance");
+        printf("------------------------------------------------------------------\n");
+        listProjectedShortfalls(familiesRoot, month, &count);
+        if (count == 0)
+            printf("No family is projected to spend more than its income.\n");
     }
     printf("\n");
 }
 
-void dateRangeCallback(Expense* exp, void* context) {
-    DateRangeFilter* filter = (DateRangeFilter*)context;
-    
-    // Check if expense is within date range
-    if ((exp->month > filter->startMonth || 
-         (exp->month == filter->startMonth && exp->day >= filter->startDay)) &&
-        (exp->month < filter->endMonth || 
-         (exp->month == filter->endMonth && exp->day <= filter->endDay))) {
-        
-        Individual* ind = searchIndividual(individualsRoot, exp->userID);
-        printf("ID: %-5d Date: %2d/%-2d %-10s %-9s %7.2f (User: %s)\n",
-               exp->expenseID,
-               exp->day, exp->month,
-               categories[exp->category],
-               "", // Padding
-               exp->amount,
-               ind ? ind->userName : "Unknown");
-        filter->hasResults = true;
-    }
+void indexIndividualNames(Individual *node) {
+    if (node == NULL) return;
+    indexIndividualNames(node->left);
+    indexName(NAME_USER, node->userID, node->userName);
+    indexIndividualNames(node->right);
 }
 
-void Get_expense_in_period() {
-    int day1, month1, day2, month2;
-    printf("Enter start date (day month): ");
-    scanf("%d %d", &day1, &month1);
-    printf("Enter end date (day month): ");
-    scanf("%d %d", &day2, &month2);
-    
-    if (month1 < 1 || month1 > 12 || month2 < 1 || month2 > 12 ||
-        day1 < 1 || day1 > DAYS_IN_MONTH || day2 < 1 || day2 > DAYS_IN_MONTH) {
-        printf("Invalid date!\n");
-        return;
+void indexFamilyNames(Family *node) {
+    if (node == NULL) return;
+    indexFamilyNames(node->left);
+    indexName(NAME_FAMILY, node->familyID, node->familyName);
+    indexFamilyNames(node->right);
+}
+
+void rebuildNameIndex() {
+    for (uint32_t i = 0; i < nameIndex.slotCount; i++)
+        free(nameIndex.slots[i].postings);
+    free(nameIndex.slots);
+    memset(&nameIndex, 0, sizeof(nameIndex));
+    indexIndividualNames(individualsRoot);
+    indexFamilyNames(familiesRoot);
+}
+
+bool nameMatches(const char *name, const char *query, bool prefix) {
+    size_t len = strlen(query);
+    for (const char *start = name; *start != '\0'; start++) {
+        size_t i = 0;
+        while (i < len && start[i] != '\0' &&
+               tolower((unsigned char)start[i]) == tolower((unsigned char)query[i]))
+            i++;
+        if (i == len)
+            return true;
+        if (prefix)
+            break;
     }
-    
-    printf("\nExpenses between %d/%d/25 and %d/%d/25:\n", day1, month1, day2, month2);
-    printf("------------------------------------------------\n");
-    
-    //a struct that records the range limits
-    //this struuct is passed to the traverse function where 
-    //each node is compared with this filter and then printed
-    
-    DateRangeFilter filter = {
-        .startDay = day1,
-        .startMonth = month1,
-        .endDay = day2,
-        .endMonth = month2,
-        .hasResults = false
-    };
-    
-    traverseExpensesWithContext(expensesRoot, dateRangeCallback, &filter);
-    
-    if (!filter.hasResults) {
-        printf("No expenses found in this period.\n");
+    return false;
+}
+
+// Current name of a posting's user or family; false if it is gone
+bool postedName(NameKind kind, int id, NameRef *name) {
+    if (kind == NAME_USER) {
+        Individual *ind = searchIndividual(individualsRoot, id);
+        if (ind != NULL)
+            *name = ind->userName;
+        return ind != NULL;
     }
-    printf("\n");
+    Family *family = searchFamily(familiesRoot, id);
+    if (family != NULL)
+        *name = family->familyName;
+    return family != NULL;
 }
 
+typedef struct {
+    const char *query;
+    int *ids;
+    int found;
+    int limit;
+    long examined;
+} NameScan;
+
+void scanIndividualNames(Individual *node, NameScan *scan) {
+    if (node == NULL || scan->found == scan->limit) return;
+    scanIndividualNames(node->left, scan);
+    scan->examined++;
+    if (scan->found < scan->limit && nameMatches(nameOf(node->userName), scan->query, false))
+        scan->ids[scan->found++] = node->userID;
+    scanIndividualNames(node->right, scan);
+}
 
+void scanFamilyNames(Family *node, NameScan *scan) {
+    if (node == NULL || scan->found == scan->limit) return;
+    scanFamilyNames(node->left, scan);
+    scan->examined++;
+    if (scan->found < scan->limit && nameMatches(nameOf(node->familyName), scan->query, false))
+        scan->ids[scan->found++] = node->familyID;
+    scanFamilyNames(node->right, scan);
+}
 
-void Get_total_expense() {
-    int familyID;
-    printf("Enter Family ID: ");
-    scanf("%d", &familyID);
-    
-    Family *family = searchFamily(familiesRoot, familyID);
-    if (family == NULL) {
-        printf("Family not found!\n");
-        return;
-    }
-    
-    // Recalculate total expense
-    family->totalExpense = 0.0;
-    FamilyMember *member = family->members;
-    while (member != NULL) {
-        ExpenseAccumulator acc = {
-            .targetUserID = member->userID,
-            .total = 0
-        };
-        traverseExpensesWithContext(expensesRoot, expenseAccumulatorCallback, &acc);
-        family->totalExpense += acc.total;
-        member = member->next;
-    }
-    
-    printf("\nFamily: %s (ID: %d)\n", family->familyName, family->familyID);
-    printf("--------------------------------\n");
-    printf("Total Monthly Income:    %.2f\n", family->totalIncome);
-    printf("Total Monthly Expenses:  %.2f\n", family->totalExpense);
-    
-    float balance = family->totalIncome - family->totalExpense;
-    
-    printf("\nExpense Analysis:\n");
-    printf("-----------------\n");
-    if (balance >= 0) {
-        printf("The family's expenses (%.2f) are WITHIN their income (%.2f).\n", 
-              family->totalExpense, family->totalIncome);
-        printf("Remaining Balance: %.2f\n", balance);
-    } else {
-        printf("WARNING: The family's expenses (%.2f) SURPASS their income (%.2f).\n", 
-              family->totalExpense, family->totalIncome);
-        printf("Deficit: %.2f\n", -balance);
+// Finds up to limit users or families whose name starts with (prefix) or
+// contains query, ignoring case. A name holds every gram of the query, so
+// only the shortest of their posting lists is walked. Substrings shorter
+// than a gram fall back to walking the tree.
+int searchNames(NameKind kind, const char *query, bool prefix, int *ids, int limit, long *examined) {
+    *examined = 0;
+    if (*query == '\0')
+        return 0;
+    if (nameIndex.stale > nameIndex.postings - nameIndex.stale)
+        rebuildNameIndex();
+
+    if (!prefix && strlen(query) < 3) {
+        NameScan scan = { .query = query, .ids = ids, .found = 0, .limit = limit, .examined = 0 };
+        if (kind == NAME_USER)
+            scanIndividualNames(individualsRoot, &scan);
+        else
+            scanFamilyNames(familiesRoot, &scan);
+        *examined = scan.examined;
+        return scan.found;
     }
-    
-    // Calculate percentage of income spent
-    if (family->totalIncome > 0) {
-        float percentage = (family->totalExpense / family->totalIncome) * 100;
-        printf("\nExpense-to-Income Ratio: %.1f%%\n", percentage);
-        
-        if (percentage > 100) {
-            printf("The family is spending %.1f%% MORE than their income!\n", percentage - 100);
-        } else if (percentage == 100) {
-            printf("The family is spending exactly 100%% of their income.\n");
-        } else {
-            printf("The family is spending %.1f%% of their income.\n", percentage);
-        }
-    } else {
-        printf("\nNote: Family has no income (income = 0).\n");
+
+    uint32_t grams[NAME_GRAM_MAX];
+    int n = nameGrams(query, prefix, grams);
+    GramList *shortest = NULL;
+    for (int i = 0; i < n; i++) {
+        GramList *list = findGram(grams[i], false);
+        if (list == NULL)
+            return 0;
+        if (shortest == NULL || list->count < shortest->count)
+            shortest = list;
     }
-    printf("\n");
-}
-void categoricalCallback(Expense *exp, void *context) {
-    CategoryContext *ctx = (CategoryContext *)context;
-    if (exp->category == ctx->category) {
-        for (int i = 0; i < ctx->memberCount; i++) {
-            if (exp->userID == ctx->contributions[i].userID) {
-                ctx->contributions[i].amount += exp->amount;
-                *(ctx->total) += exp->amount;
-                break;
-            }
-        }
+
+    int found = 0;
+    for (int i = 0; i < shortest->count && found < limit; i++) {
+        int posting = shortest->postings[i];
+        if (posting % 2 != (int)kind)
+            continue;
+        int id = posting / 2;
+        NameRef name;
+        (*examined)++;
+        if (!postedName(kind, id, &name) || !nameMatches(nameOf(name), query, prefix))
+            continue;
+        // A name changed away and back is posted twice
+        bool seen = false;
+        for (int j = 0; j < found && !seen; j++)
+            seen = (ids[j] == id);
+        if (!seen)
+            ids[found++] = id;
     }
+    return found;
 }
 
-
-
- 
-void Get_categorical_expense() {
-    int familyID, category;
-    printf("Enter Family ID: ");
-    scanf("%d", &familyID);
-    printf("Enter Category (0-Rent, 1-Utility, 2-Grocery, 3-Stationary, 4-Leisure): ");
-    scanf("%d", &category);
-    
-    if (category < 0 || category >= CATEGORIES) {
-        printf("Invalid category!\n");
+void Search_by_name() {
+    int kind, mode;
+    char query[50];
+    printf("1. Users\n2. Families\nEnter choice: ");
+    scanf("%d", &kind);
+    if (kind != 1 && kind != 2) {
+        printf("Invalid choice!\n");
         return;
     }
-    
-    Family *family = searchFamily(familiesRoot, familyID);
-    if (family == NULL) {
-        printf("Family not found!\n");
+    printf("Enter name or part of it: ");
+    scanf("%49s", query);
+    printf("1. Starts with\n2. Contains\nEnter choice: ");
+    scanf("%d", &mode);
+    if (mode != 1 && mode != 2) {
+        printf("Invalid choice!\n");
         return;
     }
 
-   Contribution contributions[4];
-    
-    int memberCount = 0;
-    float total = 0.0;
+    int ids[NAME_RESULT_LIMIT];
+    long examined;
+    double start = nowMs();
+    int found = searchNames(kind == 1 ? NAME_USER : NAME_FAMILY, query, mode == 1,
+                            ids, NAME_RESULT_LIMIT, &examined);
+    double elapsed = nowMs() - start;
 
-    // Initialize contributions array
-    FamilyMember *member = family->members;
-    while (member != NULL && memberCount < 4) {
-        Individual *ind = searchIndividual(individualsRoot, member->userID);
-        if (ind) {
-            contributions[memberCount].userID = ind->userID;
-            strcpy(contributions[memberCount].name, ind->userName);
-            contributions[memberCount].amount = 0.0;
-            memberCount++;
+    printf("\n");
+    for (int i = 0; i < found; i++) {
+        if (kind == 1) {
+            Individual *ind = searchIndividual(individualsRoot, ids[i]);
+            Family *family = findFamilyByUserID(ind->userID);
+            printf("User %-6d %-20s income %.2f%s%s\n", ind->userID, nameOf(ind->userName), ind->income,
+                   family ? ", family " : "", family ? nameOf(family->familyName) : "");
+        } else {
+            Family *family = searchFamily(familiesRoot, ids[i]);
+            printf("Family %-6d %-20s %d member(s)\n", family->familyID, nameOf(family->familyName),
+                   family->memberCount);
         }
-        member = member->next;
     }
+    if (found == 0)
+        printf("No matches.\n");
+    else if (found == NAME_RESULT_LIMIT)
+        printf("(first %d matches shown)\n", NAME_RESULT_LIMIT);
+    printf("%ld candidate(s) checked in %.3f ms\n\n", examined, elapsed);
+}
 
-    // Create and populate context
-  	CategoryContext context;
-	context.category = category;
-	context.contributions = contributions;
-	context.memberCount = memberCount;
-	context.total = &total;
-
+// Writes "Parent/Child" for a subcategory
+void categoryPath(int category, char *buf, size_t size) {
+    int parent = categoryTable[category].parent;
+    if (parent < 0) {
+        snprintf(buf, size, "%s", categoryName(category));
+        return;
+    }
+    categoryPath(parent, buf, size);
+    size_t used = strlen(buf);
+    snprintf(buf + used, size - used, "/%s", categoryName(category));
+}
 
-    // Traverse expenses with context
-    traverseExpensesWithContext(expensesRoot, categoricalCallback, &context);
+void Manage_categories() {
+    int choice;
+    char path[256];
+    printf("1. List Categories\n2. Add Category\n3. Family Category Roll-up\nEnter choice: ");
+    scanf("%d", &choice);
 
-    // Sort contributions (bubble sort)
-    for (int i = 0; i < memberCount-1; i++) {
-        for (int j = 0; j < memberCount-i-1; j++) {
-            if (contributions[j].amount < contributions[j+1].amount) {
-                 Contribution temp = contributions[j];
-                contributions[j] = contributions[j+1];
-                contributions[j+1] = temp;
-            }
+    if (choice == 1) {
+        printf("\n%-5s %s\n", "ID", "Category");
+        printf("--------------------------------\n");
+        for (int c = 0; c < categoryCount; c++) {
+            categoryPath(c, path, sizeof(path));
+            printf("%-5d %s\n", c, path);
         }
     }
-
-    // Display results
-    printf("\n%s Expenses for Family %s\n", categories[category], family->familyName);
-    printf("Total: %.2f\n", total);
-    printf("Individual Contributions:\n");
-    
-    for (int i = 0; i < memberCount; i++) {
-        if (contributions[i].amount > 0) {
-            printf("- %s (ID: %d): %.2f\n", 
-                   contributions[i].name, 
-                   contributions[i].userID,
-                   contributions[i].amount);
+    else if (choice == 2) {
+        char name[50];
+        int parent;
+        printf("Enter Category Name: ");
+        scanf("%49s", name);
+        printf("Enter Parent Category ID (-1 for none): ");
+        scanf("%d", &parent);
+        int category = addCategory(name, parent);
+        if (category < 0) {
+            printf("Could not add category: unknown parent, duplicate name or %d categories already.\n",
+                   MAX_CATEGORIES);
+            return;
+        }
+        journalBarrier();
+        shipCategory(category);
+        categoryPath(category, path, sizeof(path));
+        printf("Category %d (%s) added.\n", category, path);
+    }
+    else if (choice == 3) {
+        int familyID;
+        printf("Enter Family ID: ");
+        scanf("%d", &familyID);
+        Family *family = searchFamily(familiesRoot, familyID);
+        if (family == NULL) {
+            printf("Family not found!\n");
+            return;
+        }
+        // The family's totals already include subcategories; spending booked
+        // on a category itself is what its children do not account for
+        const CategoryMap *totals = &family->categoryExpense;
+        CategoryMap own = {0};
+        for (int i = 0; i < totals->count; i++) {
+            int c = totals->keys[i];
+            float amount = *(float*)categoryMapAt(totals, i, sizeof(float));
+            addCategoryAmount(&own, c, amount);
+            if (categoryTable[c].parent >= 0)
+                addCategoryAmount(&own, categoryTable[c].parent, -amount);
+        }
+        printf("\nFamily %s by category\n", nameOf(family->familyName));
+        printf("%-30s %10s %10s\n", "Category", "Total", "Own");
+        printf("----------------------------------------------------\n");
+        for (int i = 0; i < totals->count; i++) {
+            int c = totals->keys[i];
+            float amount = *(float*)categoryMapAt(totals, i, sizeof(float));
+            if (amount == 0)
+                continue;
+            categoryPath(c, path, sizeof(path));
+            printf("%-30s %10.2f %10.2f\n", path, amount, categoryAmount(&own, c));
         }
+        printf("----------------------------------------------------\n");
+        printf("%-30s %10.2f\n", "Total", family->totalExpense);
+        categoryMapFree(&own);
+    }
+    else {
+        printf("Invalid choice!\n");
     }
     printf("\n");
 }
 
-void dailyExpenseCallback(Expense* exp, void* context) {
-    DailyExpenseTracker* tracker = (DailyExpenseTracker*)context;
-    Family* family = searchFamily(familiesRoot, tracker->familyID);
-    if (family && isMember(family, exp->userID)) {
-        if (exp->month >= 1 && exp->month <= 12 &&
-            exp->day >= 1 && exp->day <= DAYS_IN_MONTH) {
-            tracker->dailyExpenses[exp->month-1][exp->day-1] += exp->amount;
-        }
-    }
+// File handling functions
+void writeIndividuals(FILE *file, Individual *node) {
+    if (node == NULL) return;
+    writeIndividuals(file, node->left);
+    fprintf(file, "%d %.2f %s\n", node->userID, node->income, nameOf(node->userName));
+    writeIndividuals(file, node->right);
 }
 
-void Get_highest_expense_day() {
-    int familyID;
-    printf("Enter Family ID: ");
-    scanf("%d", &familyID);
-    
-    Family *family = searchFamily(familiesRoot, familyID);
-    if (family == NULL) {
-        printf("Family not found!\n");
-        return;
-    }
-    //struct to keep a track 
-    //put this constraint wala struct in traverse() 
-    DailyExpenseTracker tracker = {
-        .familyID = familyID,
-        .dailyExpenses = {0}
-    };
-    
-    traverseExpensesWithContext(expensesRoot, dailyExpenseCallback, &tracker);
-    
-    float maxExpense = 0;
-    int maxDay = 1, maxMonth = 1;
-    
-    for (int m = 0; m < MONTHS_IN_YEAR; m++) {
-        for (int d = 0; d < DAYS_IN_MONTH; d++) {
-            if (tracker.dailyExpenses[m][d] > maxExpense) {
-                maxExpense = tracker.dailyExpenses[m][d];
-                maxDay = d + 1;
-                maxMonth = m + 1;
-            }
-        }
-    }
-    
-    if (maxExpense > 0) {
-        printf("Highest expense day for family %s: %d/%d/25 with total expense: %.2f\n", 
-              family->familyName, maxDay, maxMonth, maxExpense);
-    } else {
-        printf("No expenses found for this family.\n");
+// Closes a fully written temporary file and renames it over path. On
+// failure the old file stays in place and the error is reported.
+bool replaceFile(FILE *file, const char *tmpPath, const char *path) {
+    bool ok = !ferror(file);
+    if (fclose(file) != 0)
+        ok = false;
+    if (ok && rename(tmpPath, path) != 0)
+        ok = false;
+    if (!ok) {
+        printf("Error writing %s!\n", path);
+        remove(tmpPath);
     }
+    return ok;
 }
 
-//checks each node with the range
-//basically compares
-void idRangeCallback(Expense* exp, void* context) {
-    IDRangeFilter* filter = (IDRangeFilter*)context;
+// ruleID userID category amount day startMonth endMonth postedThrough
+bool saveRecurringToFile() {
+    FILE *file = fopen(RECURRING_FILE ".tmp", "w+");
+    if (file == NULL) {
+        printf("Error opening file for writing!\n");
+        return false;
+    }
     
-    if (exp->userID == filter->userID && 
-        exp->expenseID >= filter->startID && 
-        exp->expenseID <= filter->endID) {
-        
-        printf("ID: %-5d Date: %2d/%-2d %-10s %7.2f\n",
-               exp->expenseID,
-               exp->day, exp->month,
-               categories[exp->category],
-               exp->amount);
-        filter->hasResults = true;
+    for (int i = 0; i < ruleCount; i++) {
+        RecurringRule *rule = &rules[i];
+        fprintf(file, "%d %d %d %.2f %d %d %d %d\n", rule->ruleID, rule->userID, rule->category,
+                rule->amount, rule->day, rule->startMonth, rule->endMonth, rule->postedThrough);
     }
+    return replaceFile(file, RECURRING_FILE ".tmp", RECURRING_FILE);
 }
 
-
-void Get_expense_in_range() {
-    int userID, expID1, expID2;
-    printf("Enter User ID: ");
-    scanf("%d", &userID);
-    printf("Enter start Expense ID: ");
-    scanf("%d", &expID1);
-    printf("Enter end Expense ID: ");
-    scanf("%d", &expID2);
-    
-    Individual *ind = searchIndividual(individualsRoot, userID);
-    if (ind == NULL) {
-        printf("User not found!\n");
-        return;
+// categoryID parent name, for the categories added after the built-in ones
+bool saveCategoriesToFile() {
+    FILE *file = fopen(CATEGORIES_FILE ".tmp", "w+");
+    if (file == NULL) {
+        printf("Error opening file for writing!\n");
+        return false;
     }
     
-    if (expID1 > expID2) {
-        printf("Invalid range!\n");
-        return;
+    for (int c = DEFAULT_CATEGORIES; c < categoryCount; c++)
+        fprintf(file, "%d %d %s\n", c, categoryTable[c].parent, categoryName(c));
+    return replaceFile(file, CATEGORIES_FILE ".tmp", CATEGORIES_FILE);
+}
+
+bool saveIndividualsToFile() {
+    FILE *file = fopen("individuals.txt.tmp", "w+");
+    if (file == NULL) {
+        printf("Error opening file for writing!\n");
+        return false;
     }
     
-    printf("\nExpenses for %s (ID: %d) between IDs %d and %d:\n", 
-           ind->userName, userID, expID1, expID2);
-    printf("------------------------------------------------\n");
-    
-    //basically a struct that stores the curr range, this struct is passed 
-    //while traversing so we set the start and end points
-    
-    IDRangeFilter filter = {
-        .userID = userID,
-        .startID = expID1,
-        .endID = expID2,
-        .hasResults = false
-    };
-    
-    traverseExpensesWithContext(expensesRoot, idRangeCallback, &filter);
-    
-    if (!filter.hasResults) {
-        printf("No expenses found in this range.\n");
+    writeIndividuals(file, individualsRoot);
+    bool ok = replaceFile(file, "individuals.txt.tmp", "individuals.txt");
+    ok = saveRecurringToFile() && ok;
+    ok = saveCategoriesToFile() && ok;
+    return ok;
+}
+
+// familyID slot limit, where slot is a category or -1 for the family total
+void writeBudgets(FILE *file, Family *node) {
+    if (node == NULL) return;
+    writeBudgets(file, node->left);
+    for (int i = 0; i < node->budgets.count; i++) {
+        Budget *budget = (Budget*)categoryMapAt(&node->budgets, i, sizeof(Budget));
+        fprintf(file, "%d %d %.2f\n", node->familyID, node->budgets.keys[i], budget->limit);
     }
-    printf("\n");
+    writeBudgets(file, node->right);
 }
 
-// File handling functions
-void saveIndividualsToFile() {
-    FILE *file = fopen("individuals.txt", "w+");
+bool saveBudgetsToFile() {
+    FILE *file = fopen(BUDGETS_FILE ".tmp", "w+");
     if (file == NULL) {
         printf("Error opening file for writing!\n");
-        return;
+        return false;
     }
     
-    // Need to implement tree traversal and saving
-    fclose(file);
+    writeBudgets(file, familiesRoot);
+    return replaceFile(file, BUDGETS_FILE ".tmp", BUDGETS_FILE);
+}
+
+// familyID totalExpense memberCount member... name
+void writeFamilies(FILE *file, Family *node) {
+    if (node == NULL) return;
+    writeFamilies(file, node->left);
+    fprintf(file, "%d %.2f %d", node->familyID, node->totalExpense, node->memberCount);
+    for (int i = 0; i < node->memberCount; i++)
+        fprintf(file, " %d", node->members[i]);
+    fprintf(file, " %s\n", nameOf(node->familyName));
+    writeFamilies(file, node->right);
 }
 
-void saveFamiliesToFile() {
-    FILE *file = fopen("families.txt", "w+");
+bool saveFamiliesToFile() {
+    FILE *file = fopen("families.txt.tmp", "w+");
     if (file == NULL) {
         printf("Error opening file for writing!\n");
-        return;
+        return false;
     }
     
-    // Need to implement tree traversal and saving
-    fclose(file);
+    writeFamilies(file, familiesRoot);
+    bool ok = replaceFile(file, "families.txt.tmp", "families.txt");
+    ok = saveBudgetsToFile() && ok;
+    return ok;
+}
+
+void fillStorePages(Expense *node, ExpenseRecord *records, int *pageFirstID, uint32_t *n) {
+    if (node == NULL) return;
+    fillStorePages(node->left, records, pageFirstID, n);
+    ExpenseRecord *rec = &records[*n];
+    rec->expenseID = node->expenseID;
+    rec->userID = node->userID;
+    rec->category = node->category;
+    rec->amount = node->amount;
+    rec->day = node->day;
+    rec->month = node->month;
+    if (*n % RECORDS_PER_PAGE == 0)
+        pageFirstID[*n / RECORDS_PER_PAGE] = node->expenseID;
+    (*n)++;
+    fillStorePages(node->right, records, pageFirstID, n);
 }
 
-void saveExpensesToFile() {
-    FILE *file = fopen("expenses.txt", "w+");
+// Writes the paged store to a temporary file and renames it into place, so
+// a crash mid-write never leaves a torn expenses.dat (and an existing
+// mapping of the old file stays valid).
+bool saveExpensesToFile() {
+    // Nothing has changed since the store was opened
+    if (expenseStore.cold)
+        return true;
+
+    uint32_t count = (uint32_t)countExpense(expensesRoot);
+    uint32_t dataPages = (count + RECORDS_PER_PAGE - 1) / RECORDS_PER_PAGE;
+    uint32_t indexPages = (dataPages + INDEX_ENTRIES_PER_PAGE - 1) / INDEX_ENTRIES_PER_PAGE;
+    size_t length = (size_t)(1 + indexPages + dataPages) * STORE_PAGE_SIZE;
+
+    char *image = (char*)calloc(1, length);
+    StoreHeader *header = (StoreHeader*)image;
+    header->magic = STORE_MAGIC;
+    header->version = STORE_VERSION;
+    header->recordCount = count;
+    header->dataPages = dataPages;
+    header->indexPages = indexPages;
+
+    uint32_t n = 0;
+    fillStorePages(expensesRoot, (ExpenseRecord*)(image + (size_t)(1 + indexPages) * STORE_PAGE_SIZE),
+                   (int*)(image + STORE_PAGE_SIZE), &n);
+
+    FILE *file = fopen(EXPENSE_STORE_FILE ".tmp", "wb");
     if (file == NULL) {
         printf("Error opening file for writing!\n");
+        free(image);
+        return false;
+    }
+    
+    size_t written = fwrite(image, 1, length, file);
+    free(image);
+    if (written != length) {
+        fclose(file);
+        printf("Error writing %s!\n", EXPENSE_STORE_FILE);
+        remove(EXPENSE_STORE_FILE ".tmp");
+        return false;
+    }
+    return replaceFile(file, EXPENSE_STORE_FILE ".tmp", EXPENSE_STORE_FILE);
+}
+
+void loadRecurringFromFile() {
+    FILE *file = fopen(RECURRING_FILE, "r");
+    if (file == NULL)
         return;
+    
+    RecurringRule r;
+    while (fscanf(file, "%d %d %d %f %d %d %d %d", &r.ruleID, &r.userID, &r.category, &r.amount,
+                  &r.day, &r.startMonth, &r.endMonth, &r.postedThrough) == 8) {
+        if (searchIndividual(individualsRoot, r.userID) == NULL)
+            continue;
+        RecurringRule *rule = addRecurringRule(r.userID, r.category, r.amount, r.day, r.startMonth, r.endMonth);
+        rule->ruleID = r.ruleID;
+        rule->postedThrough = r.postedThrough;
+        if (r.ruleID >= nextRuleID)
+            nextRuleID = r.ruleID + 1;
     }
+    fclose(file);
+}
+
+// Everything else refers to categories by ID, so they load first
+void loadCategoriesFromFile() {
+    initCategories();
+    FILE *file = fopen(CATEGORIES_FILE, "r");
+    if (file == NULL)
+        return;
     
-    // Need to implement tree traversal and saving
+    int category, parent;
+    char name[50];
+    while (fscanf(file, "%d %d %49s", &category, &parent, name) == 3) {
+        if (category != categoryCount || addCategory(name, parent) < 0) {
+            printf("Warning: %s is inconsistent at category %d; later entries skipped.\n",
+                   CATEGORIES_FILE, category);
+            break;
+        }
+    }
     fclose(file);
 }
 
 void loadIndividualsFromFile() {
+    loadCategoriesFromFile();
     FILE *file = fopen("individuals.txt", "r+");
     if (file == NULL) {
         printf("No existing individuals data found. Starting fresh.\n");
         return;
     }
     
-    // Need to implement loading and tree reconstruction
+    int userID;
+    float income;
+    char userName[256];
+    while (fscanf(file, "%d %f %255s", &userID, &income, userName) == 3) {
+        individualsRoot = insertIndividual(individualsRoot, userID, userName, income);
+    }
+    fclose(file);
+    loadRecurringFromFile();
+}
+
+// Alert levels are settled once the category totals are known
+void loadBudgetsFromFile() {
+    FILE *file = fopen(BUDGETS_FILE, "r");
+    if (file == NULL)
+        return;
+    
+    int familyID, slot;
+    float limit;
+    while (fscanf(file, "%d %d %f", &familyID, &slot, &limit) == 3) {
+        Family *family = searchFamily(familiesRoot, familyID);
+        if (family == NULL || limit <= 0 || (slot != FAMILY_TOTAL && !isValidCategory(slot)))
+            continue;
+        ((Budget*)categoryMapGet(&family->budgets, slot, sizeof(Budget)))->limit = limit;
+    }
     fclose(file);
 }
 
+// Needs the individuals loaded first so family incomes can be summed
 void loadFamiliesFromFile() {
     FILE *file = fopen("families.txt", "r+");
     if (file == NULL) {
@@ -1560,19 +7425,151 @@ void loadFamiliesFromFile() {
         return;
     }
     
-    // Need to implement loading and tree reconstruction
+    int familyID, memberCount;
+    float totalExpense;
+    char familyName[256];
+    while (fscanf(file, "%d %f %d", &familyID, &totalExpense, &memberCount) == 3) {
+        int members[MAX_FAMILY_MEMBERS];
+        if (memberCount < 0 || memberCount > MAX_FAMILY_MEMBERS)
+            break;
+        int read = 0;
+        while (read < memberCount && fscanf(file, "%d", &members[read]) == 1)
+            read++;
+        if (read < memberCount || fscanf(file, "%255s", familyName) != 1)
+            break;
+        
+        familiesRoot = insertFamily(familiesRoot, familyID, familyName);
+        Family *family = searchFamily(familiesRoot, familyID);
+        for (int i = 0; i < memberCount; i++)
+            addFamilyMember(family, members[i]);
+        family->totalExpense = totalExpense;
+    }
     fclose(file);
+    loadBudgetsFromFile();
+}
+
+void settleAllBudgets(Family *node) {
+    if (node == NULL) return;
+    settleAllBudgets(node->left);
+    settleBudgets(node);
+    settleAllBudgets(node->right);
+}
+
+// Per-category family totals and forecast sums are not stored; one pass
+// over the mapped records rebuilds them without hydrating the trees
+void loadFamilyCategoryTotals() {
+    Family **familyOf = (Family**)calloc(MAX_USERS + 1, sizeof(Family*));
+    mapFamilyMembers(familiesRoot, familyOf);
+    for (uint32_t i = 0; i < expenseStore.header->recordCount; i++) {
+        const ExpenseRecord *rec = storeRecord(i);
+        rollingDay(rec->day, rec->month);   // today, for recurring due dates
+        if (rec->userID < 0 || rec->userID > MAX_USERS ||
+            !isValidCategory(rec->category))
+            continue;
+        Family *family = familyOf[rec->userID];
+        if (family != NULL) {
+            rollUpCategoryAmount(&family->categoryExpense, rec->category, rec->amount);
+            addFamilyTrend(family, rec->category, rec->day, rec->month, rec->amount);
+        }
+    }
+    free(familyOf);
+    settleAllBudgets(familiesRoot);
 }
 
+// Maps expenses.dat and checks the header; expense pages are faulted in
+// only when a query reaches them.
 void loadExpensesFromFile() {
-    FILE *file = fopen("expenses.txt", "w+");
-    if (file == NULL) {
+    int fd = open(EXPENSE_STORE_FILE, O_RDONLY);
+    if (fd < 0) {
         printf("No existing expenses data found. Starting fresh.\n");
         return;
     }
     
-    // Need to implement loading and tree reconstruction
-    fclose(file);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < STORE_PAGE_SIZE) {
+        printf("Expense store is damaged. Starting fresh.\n");
+        close(fd);
+        return;
+    }
+    
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        printf("Could not map expense store. Starting fresh.\n");
+        return;
+    }
+    
+    const StoreHeader *header = (const StoreHeader*)base;
+    size_t expected = (size_t)(1 + header->indexPages + header->dataPages) * STORE_PAGE_SIZE;
+    if (header->magic != STORE_MAGIC || header->version != STORE_VERSION ||
+        expected > (size_t)st.st_size ||
+        header->recordCount > (uint64_t)header->dataPages * RECORDS_PER_PAGE) {
+        printf("Expense store is damaged. Starting fresh.\n");
+        munmap(base, st.st_size);
+        return;
+    }
+    
+    expenseStore.base = base;
+    expenseStore.length = st.st_size;
+    expenseStore.header = header;
+    expenseStore.pageFirstID = (const int*)((const char*)base + STORE_PAGE_SIZE);
+    expenseStore.pages = (const ExpenseRecord*)((const char*)base + (size_t)(1 + header->indexPages) * STORE_PAGE_SIZE);
+    expenseStore.cold = true;
+    loadFamilyCategoryTotals();
+}
+
+// Checkpoints run in a forked child: fork gives it a copy-on-write,
+// point-in-time view of every tree, so it can write all three files while
+// the menu loop keeps taking reads and writes. The only pause the user
+// sees is fork itself copying the page tables, which is measured here.
+void startCheckpoint() {
+    if (checkpointPid > 0) {
+        printf("A checkpoint is already running.\n");
+        return;
+    }
+
+    fflush(stdout);
+    double start = nowMs();
+    pid_t pid = fork();
+    if (pid < 0) {
+        printf("Could not start checkpoint, saving in the foreground.\n");
+        saveIndividualsToFile();
+        saveFamiliesToFile();
+        saveExpensesToFile();
+        return;
+    }
+    if (pid == 0) {
+        bool ok = saveIndividualsToFile();
+        ok = saveFamiliesToFile() && ok;
+        ok = saveExpensesToFile() && ok;
+        fflush(stdout);
+        _exit(ok ? 0 : 1);
+    }
+
+    checkpointPid = pid;
+    checkpointStartMs = start;
+    checkpointStallMs = nowMs() - start;
+    writesSinceCheckpoint = 0;
+    printf("Checkpoint started in the background (menu stalled %.3f ms).\n", checkpointStallMs);
+}
+
+// Reaps a finished checkpoint; with wait set, blocks until it is done
+void pollCheckpoint(bool wait) {
+    if (checkpointPid <= 0)
+        return;
+
+    int status;
+    pid_t done = waitpid(checkpointPid, &status, wait ? 0 : WNOHANG);
+    if (done != checkpointPid)
+        return;
+
+    checkpointPid = 0;
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        printf("\nCheckpoint complete in %.1f ms (menu stalled %.3f ms).\n",
+               nowMs() - checkpointStartMs, checkpointStallMs);
+    } else {
+        printf("\nCheckpoint failed!\n");
+    }
 }
 
 void displayMenu() {
@@ -1590,21 +7587,97 @@ void displayMenu() {
     printf("9. Get Individual Expense\n");
     printf("10. Get Expenses in Date Range\n");
     printf("11. Get Expenses in ID Range\n");
-    printf("12. Exit\n");
+    printf("12. Apply Expense Batch File\n");
+    printf("13. Query Expenses\n");
+    printf("14. Expense ID Statistics\n");
+    printf("15. Expense Amount Statistics\n");
+    printf("16. Checkpoint (Background Save)\n");
+    printf("17. Reports As Of Version\n");
+    printf("18. Undo / Change History\n");
+    printf("19. Sharded Reports / Benchmark\n");
+    printf("20. Anomalous Expenses\n");
+    printf("21. Family Budgets\n");
+    printf("22. Recurring Expenses\n");
+    printf("23. Monthly Forecast\n");
+    printf("24. Categories\n");
+    printf("25. Search by Name\n");
+    printf("26. Family Summary\n");
+    printf("27. Freeze / Thaw Trees\n");
+    printf("28. Rolling Spend (7/30 Days)\n");
+    printf("29. Exit\n");
     printf("Enter your choice: ");
 }
 
-int main() {
+// Read-only replica: serves reports from its own trees while a background
+// thread applies the primary's replication log. Reports and applying take
+// turns on replicaLock, so a report sitting in a prompt holds back apply.
+int runReplica() {
+    replicaMode = true;
+    journalPaused = true;
+    loadIndividualsFromFile();
+    loadFamiliesFromFile();
+    loadExpensesFromFile();
+
+    pthread_t tail;
+    if (pthread_create(&tail, NULL, tailReplicationLog, NULL) != 0) {
+        printf("Could not start the replication thread.\n");
+        return 1;
+    }
+    printf("-----------------------------------------------------------");
+    printf("\n\tExpense Tracking System (read-only replica)\n");
+    printf("\n-----------------------------------------------------------");
+
+    int choice;
+    do {
+        printf("\n1. Get Total Family Expense\n");
+        printf("2. Get Categorical Expense\n");
+        printf("3. Get Highest Expense Day\n");
+        printf("4. Get Individual Expense\n");
+        printf("5. Get Expenses in Date Range\n");
+        printf("6. Replication Status\n");
+        printf("7. Exit\n");
+        printf("Enter your choice: ");
+        if (scanf("%d", &choice) != 1)
+            break;
+
+        pthread_mutex_lock(&replicaLock);
+        switch(choice) {
+            case 1: Get_total_expense(); break;
+            case 2: Get_categorical_expense(); break;
+            case 3: Get_highest_expense_day(); break;
+            case 4: Get_individual_expense(); break;
+            case 5: Get_expense_in_period(); break;
+            case 6: printReplicationStatus(); break;
+            case 7: break;
+            default: printf("Invalid choice!\n");
+        }
+        pthread_mutex_unlock(&replicaLock);
+    } while (choice != 7);
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "--replica") == 0)
+        return runReplica();
+
     loadIndividualsFromFile();
     loadFamiliesFromFile();
     loadExpensesFromFile();
+    // A fresh log per session; a replica notices the new file and replays it
+    unlink(REPLICATION_LOG);
+    replicationLog = fopen(REPLICATION_LOG, "w");
     printf("-----------------------------------------------------------");
     printf("\n\tWelcome to our Expense Tracking System!\n");
     printf("\n-----------------------------------------------------------");
     int choice;
+    bool saved;
     do {
+        pollCheckpoint(false);
         displayMenu();
         scanf("%d", &choice);
+        beginJournalOp();
+        unsigned long mutationsBefore = mutationCount;
         
         switch(choice) {
             case 1: Add_User(); break;
@@ -1618,15 +7691,52 @@ int main() {
             case 9: Get_individual_expense(); break;
             case 10: Get_expense_in_period(); break;
             case 11: Get_expense_in_range(); break;
-            case 12: 
-                saveIndividualsToFile();
-                saveFamiliesToFile();
-                saveExpensesToFile();
-                printf("Data saved. Exiting...\n");
+            case 12: Apply_expense_batch(); break;
+            case 13: Query_expenses(); break;
+            case 14: Get_expense_statistics(); break;
+            case 15: Get_amount_statistics(); break;
+            case 16: startCheckpoint(); break;
+            case 17: Reports_as_of(); break;
+            case 18: Undo_and_history(); break;
+            case 19: Sharded_reports(); break;
+            case 20: Get_anomalous_expenses(); break;
+            case 21: Family_budgets(); break;
+            case 22: Recurring_expenses(); break;
+            case 23: Monthly_forecast(); break;
+            case 24: Manage_categories(); break;
+            case 25: Search_by_name(); break;
+            case 26: Family_summary(); break;
+            case 27: Freeze_trees(); break;
+            case 28: Rolling_spend(); break;
+            case 29: 
+                // Let a running checkpoint finish before writing the same files
+                pollCheckpoint(true);
+                saved = saveIndividualsToFile();
+                saved = saveFamiliesToFile() && saved;
+                saved = saveExpensesToFile() && saved;
+                if (journalFile != NULL)
+                    fclose(journalFile);
+                if (replicationLog != NULL)
+                    fclose(replicationLog);
+                if (saved)
+                    printf("Data saved. Exiting...\n");
+                else
+                    printf("Some data could not be saved. Exiting...\n");
                 break;
             default: printf("Invalid choice!\n");
         }
-    } while (choice != 12);
+        
+        // Ship this action's records before taking the next one
+        if (replicationLog != NULL && choice != 29)
+            fflush(replicationLog);
+        
+        // Writes between checkpoints bound how much a crash can lose; only
+        // actions that changed something count, not reads or failed attempts
+        if (mutationCount != mutationsBefore) {
+            if (++writesSinceCheckpoint >= CHECKPOINT_INTERVAL && checkpointPid == 0)
+                startCheckpoint();
+        }
+    } while (choice != 29);
     
     return 0;
 }